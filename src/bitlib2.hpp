@@ -3,8 +3,25 @@
 
 
 #include <vector>
+#include <algorithm>
 #include <cstring>
 #include <memory>
+#include <new>
+#include <iterator>
+
+
+/**
+ * Runtime CPU dispatch of the SIMD kernels (x86-64 with GCC or Clang only).
+ * Define BITLIB2_NO_SIMD to always use the portable implementations.
+ */
+#if !defined(BITLIB2_NO_SIMD) && defined(__GNUC__) && defined(__x86_64__)
+#define BITLIB2_X86_DISPATCH 1
+#include <immintrin.h>
+#define BITLIB2_TARGET(features) __attribute__((target(features)))
+#if (defined(__clang__) && __clang_major__ >= 8) || (!defined(__clang__) && __GNUC__ >= 8)
+#define BITLIB2_X86_AVX512_DISPATCH 1
+#endif
+#endif
 
 
 namespace bitlib2 {
@@ -102,22 +119,286 @@ namespace bitlib2 {
         }
 
 
+        /**
+         * Count the number of 'ON' bits in a 64 bit word.
+         * @param w Data word.
+         * @return Number of bits (between 0 and 64).
+         */
+        inline static std::size_t countBitsInWord(unsigned long long w) {
+#if defined(__GNUC__) && (defined(__POPCNT__) || !defined(__x86_64__))
+            return __builtin_popcountll(w);
+#else
+            w = w - ((w >> 1) & 0x5555555555555555ULL);
+            w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+            w = (w + (w >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+            return (w * 0x0101010101010101ULL) >> 56;
+#endif
+        }
+
+
+        /**
+         * Count the number of 'ON' bits in a byte buffer, one byte at a time.
+         * Note: Portable fallback for the word-level and SIMD kernels.
+         * @param data Byte data buffer.
+         * @param byteCount Number of bytes in the buffer.
+         * @return Number of 'ON' bits.
+         */
+        inline static std::size_t countBitsInBytesLUT(const byte* data, std::size_t byteCount) {
+            std::size_t count = 0;
+            const byte* const end = data + byteCount;
+            for (; data != end; ++data) {
+                count += countBitsInByte(*data);
+            }
+            return count;
+        }
+
+
+        /**
+         * Count the number of 'ON' bits in a byte buffer, one 64 bit word at a time.
+         * @param data Byte data buffer.
+         * @param byteCount Number of bytes in the buffer.
+         * @return Number of 'ON' bits.
+         */
+        inline static std::size_t countBitsInBytesWord(const byte* data, std::size_t byteCount) {
+            std::size_t count = 0;
+            const byte* const wordEnd = data + (byteCount & ~(std::size_t)7);
+            for (; data != wordEnd; data += 8) {
+                unsigned long long w;
+                std::memcpy(&w, data, 8);
+                count += countBitsInWord(w);
+            }
+            return count + countBitsInBytesLUT(data, byteCount % 8);
+        }
+
+
+#ifdef BITLIB2_X86_DISPATCH
+        /**
+         * CPU features detected at runtime.
+         */
+        struct CpuFeatures {
+            bool popcnt;
+            bool avx2;
+            bool avx512f;
+            bool avx512vpopcntdq;
+            bool bmi2;
+
+            /**
+             * Return the features of the CPU we are running on (detected once).
+             */
+            static const CpuFeatures& get() {
+                static const CpuFeatures features = detect();
+                return features;
+            }
+
+            private:
+                static CpuFeatures detect() {
+                    __builtin_cpu_init();
+                    CpuFeatures features;
+                    features.popcnt = __builtin_cpu_supports("popcnt");
+                    features.avx2 = __builtin_cpu_supports("avx2");
+                    features.bmi2 = __builtin_cpu_supports("bmi2");
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+                    features.avx512f = __builtin_cpu_supports("avx512f");
+                    features.avx512vpopcntdq = features.avx512f && __builtin_cpu_supports("avx512vpopcntdq");
+#else
+                    features.avx512f = false;
+                    features.avx512vpopcntdq = false;
+#endif
+                    return features;
+                }
+        };
+
+
+        /**
+         * Count the number of 'ON' bits in a byte buffer with the POPCNT instruction.
+         * @param data Byte data buffer.
+         * @param byteCount Number of bytes in the buffer.
+         * @return Number of 'ON' bits.
+         */
+        BITLIB2_TARGET("popcnt")
+        inline static std::size_t countBitsInBytesPopcnt(const byte* data, std::size_t byteCount) {
+            unsigned long long counts[4] = {0, 0, 0, 0};
+            const byte* const blockEnd = data + (byteCount & ~(std::size_t)31);
+            for (; data != blockEnd; data += 32) {
+                unsigned long long w[4];
+                std::memcpy(w, data, 32);
+                counts[0] += _mm_popcnt_u64(w[0]);
+                counts[1] += _mm_popcnt_u64(w[1]);
+                counts[2] += _mm_popcnt_u64(w[2]);
+                counts[3] += _mm_popcnt_u64(w[3]);
+            }
+            const byte* const wordEnd = data + ((byteCount % 32) & ~(std::size_t)7);
+            for (; data != wordEnd; data += 8) {
+                unsigned long long w;
+                std::memcpy(&w, data, 8);
+                counts[0] += _mm_popcnt_u64(w);
+            }
+            return counts[0] + counts[1] + counts[2] + counts[3] + countBitsInBytesLUT(data, byteCount % 8);
+        }
+
+
+        /**
+         * Count the 'ON' bits per 64 bit lane of a 256 bit vector (nibble lookup with PSHUFB).
+         */
+        BITLIB2_TARGET("avx2")
+        inline static __m256i countBitsAvx2(const __m256i v) {
+            const __m256i lookup = _mm256_setr_epi8(
+                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+            const __m256i lowMask = _mm256_set1_epi8(0x0F);
+            const __m256i low = _mm256_and_si256(v, lowMask);
+            const __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowMask);
+            const __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low), _mm256_shuffle_epi8(lookup, high));
+            return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+        }
+
+
+        /**
+         * Carry-save adder on 256 bit vectors, used by the Harley-Seal bit-count.
+         */
+        BITLIB2_TARGET("avx2")
+        inline static void carrySaveAddAvx2(__m256i& high, __m256i& low, const __m256i b, const __m256i c) {
+            const __m256i u = _mm256_xor_si256(low, b);
+            high = _mm256_or_si256(_mm256_and_si256(low, b), _mm256_and_si256(u, c));
+            low = _mm256_xor_si256(u, c);
+        }
+
+
+        /**
+         * Count the number of 'ON' bits in a byte buffer with AVX2 (Harley-Seal carry-save adder tree).
+         * @param data Byte data buffer.
+         * @param byteCount Number of bytes in the buffer.
+         * @return Number of 'ON' bits.
+         */
+        BITLIB2_TARGET("avx2,popcnt")
+        inline static std::size_t countBitsInBytesAvx2(const byte* data, std::size_t byteCount) {
+            const __m256i* const vectors = reinterpret_cast<const __m256i*>(data);
+            const std::size_t vectorCount = byteCount / 32;
+            __m256i total = _mm256_setzero_si256();
+            __m256i ones = _mm256_setzero_si256();
+            __m256i twos = _mm256_setzero_si256();
+            __m256i fours = _mm256_setzero_si256();
+            __m256i eights = _mm256_setzero_si256();
+            __m256i sixteens, twosA, twosB, foursA, foursB, eightsA, eightsB;
+
+            std::size_t i = 0;
+            for (; i + 16 <= vectorCount; i += 16) {
+                carrySaveAddAvx2(twosA, ones, _mm256_loadu_si256(vectors + i), _mm256_loadu_si256(vectors + i + 1));
+                carrySaveAddAvx2(twosB, ones, _mm256_loadu_si256(vectors + i + 2), _mm256_loadu_si256(vectors + i + 3));
+                carrySaveAddAvx2(foursA, twos, twosA, twosB);
+                carrySaveAddAvx2(twosA, ones, _mm256_loadu_si256(vectors + i + 4), _mm256_loadu_si256(vectors + i + 5));
+                carrySaveAddAvx2(twosB, ones, _mm256_loadu_si256(vectors + i + 6), _mm256_loadu_si256(vectors + i + 7));
+                carrySaveAddAvx2(foursB, twos, twosA, twosB);
+                carrySaveAddAvx2(eightsA, fours, foursA, foursB);
+                carrySaveAddAvx2(twosA, ones, _mm256_loadu_si256(vectors + i + 8), _mm256_loadu_si256(vectors + i + 9));
+                carrySaveAddAvx2(twosB, ones, _mm256_loadu_si256(vectors + i + 10), _mm256_loadu_si256(vectors + i + 11));
+                carrySaveAddAvx2(foursA, twos, twosA, twosB);
+                carrySaveAddAvx2(twosA, ones, _mm256_loadu_si256(vectors + i + 12), _mm256_loadu_si256(vectors + i + 13));
+                carrySaveAddAvx2(twosB, ones, _mm256_loadu_si256(vectors + i + 14), _mm256_loadu_si256(vectors + i + 15));
+                carrySaveAddAvx2(foursB, twos, twosA, twosB);
+                carrySaveAddAvx2(eightsB, fours, foursA, foursB);
+                carrySaveAddAvx2(sixteens, eights, eightsA, eightsB);
+                total = _mm256_add_epi64(total, countBitsAvx2(sixteens));
+            }
+
+            total = _mm256_slli_epi64(total, 4);
+            total = _mm256_add_epi64(total, _mm256_slli_epi64(countBitsAvx2(eights), 3));
+            total = _mm256_add_epi64(total, _mm256_slli_epi64(countBitsAvx2(fours), 2));
+            total = _mm256_add_epi64(total, _mm256_slli_epi64(countBitsAvx2(twos), 1));
+            total = _mm256_add_epi64(total, countBitsAvx2(ones));
+            for (; i < vectorCount; ++i) {
+                total = _mm256_add_epi64(total, countBitsAvx2(_mm256_loadu_si256(vectors + i)));
+            }
+
+            unsigned long long lanes[4];
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), total);
+            return lanes[0] + lanes[1] + lanes[2] + lanes[3] + countBitsInBytesPopcnt(data + vectorCount * 32, byteCount % 32);
+        }
+
+
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+        /**
+         * Count the number of 'ON' bits in a byte buffer with the AVX-512 VPOPCNTQ instruction.
+         * @param data Byte data buffer.
+         * @param byteCount Number of bytes in the buffer.
+         * @return Number of 'ON' bits.
+         */
+        BITLIB2_TARGET("avx512f,avx512vpopcntdq,popcnt")
+        inline static std::size_t countBitsInBytesAvx512(const byte* data, std::size_t byteCount) {
+            const std::size_t vectorCount = byteCount / 64;
+            __m512i totalA = _mm512_setzero_si512();
+            __m512i totalB = _mm512_setzero_si512();
+            std::size_t i = 0;
+            for (; i + 2 <= vectorCount; i += 2) {
+                totalA = _mm512_add_epi64(totalA, _mm512_popcnt_epi64(_mm512_loadu_si512(data + i * 64)));
+                totalB = _mm512_add_epi64(totalB, _mm512_popcnt_epi64(_mm512_loadu_si512(data + i * 64 + 64)));
+            }
+            if (i < vectorCount) {
+                totalA = _mm512_add_epi64(totalA, _mm512_popcnt_epi64(_mm512_loadu_si512(data + i * 64)));
+            }
+            unsigned long long lanes[8];
+            _mm512_storeu_si512(lanes, _mm512_add_epi64(totalA, totalB));
+            const std::size_t count = lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+            return count + countBitsInBytesPopcnt(data + vectorCount * 64, byteCount % 64);
+        }
+#endif
+#endif
+
+
+        typedef std::size_t (*CountBitsInBytesFunction)(const byte* data, std::size_t byteCount);
+
+
+        /**
+         * Select the fastest bit-count kernel supported by the CPU.
+         * @return Bit-count function.
+         */
+        inline static CountBitsInBytesFunction selectCountBitsInBytesFunction() {
+#ifdef BITLIB2_X86_DISPATCH
+            const CpuFeatures& cpu = CpuFeatures::get();
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+            if (cpu.avx512vpopcntdq && cpu.popcnt) {
+                return &countBitsInBytesAvx512;
+            }
+#endif
+            if (cpu.avx2 && cpu.popcnt) {
+                return &countBitsInBytesAvx2;
+            }
+            if (cpu.popcnt) {
+                return &countBitsInBytesPopcnt;
+            }
+            return &countBitsInBytesLUT;
+#elif defined(__GNUC__)
+            return &countBitsInBytesWord;
+#else
+            return &countBitsInBytesLUT;
+#endif
+        }
+
+
+        /**
+         * Count the number of 'ON' bits in a byte buffer.
+         * Note: The kernel is selected once, on first use, by CPU detection.
+         * @param data Byte data buffer.
+         * @param byteCount Number of bytes in the buffer.
+         * @return Number of 'ON' bits.
+         */
+        inline static std::size_t countBitsInBytes(const byte* data, std::size_t byteCount) {
+            static const CountBitsInBytesFunction countFunction = selectCountBitsInBytesFunction();
+            return countFunction(data, byteCount);
+        }
+
+
         /**
          * Count the number of 'ON' bits in the block.
          * @param bitLength Include only 'bitLength' bits in the count.
          * @return Number of 'ON' bits.
          */
         inline static std::size_t countBits(const byte* data, std::size_t bitLength) {
-            std::size_t count = 0;
-            const byte* const end = data + (bitLength / 8);
-            const byte* part = data;
-            for (; part != end; ++part) {
-                count += countBitsInByte(*part);
-            }
+            std::size_t count = countBitsInBytes(data, bitLength / 8);
 
             const byte mask = ((byte)1 << (bitLength % 8)) - 1;
-            if (mask && part <= end) {
-                const byte maskedPart = *part & mask;
+            if (mask) {
+                const byte maskedPart = data[bitLength / 8] & mask;
                 count += countBitsInByte(maskedPart);
             }
 
@@ -125,6 +406,54 @@ namespace bitlib2 {
         }
 
 
+        /**
+         * Count the number of 'ON' bits in a bit range of a byte buffer.
+         * @param data Byte data buffer.
+         * @param begin First bit-index of the range.
+         * @param end Bit-index after the last bit of the range.
+         * @return Number of 'ON' bits.
+         */
+        inline static std::size_t countBitsInRange(const byte* data, std::size_t begin, std::size_t end) {
+            if (begin >= end) {
+                return 0;
+            }
+            const byte* const rangeData = data + begin / 8;
+            const byte skippedPart = rangeData[0] & (((byte)1 << (begin % 8)) - 1);
+            return countBits(rangeData, end - (begin / 8) * 8) - countBitsInByte(skippedPart);
+        }
+
+
+        /**
+         * Set all bits in a bit range of a byte buffer to the same value.
+         * @param data Byte data buffer.
+         * @param begin First bit-index of the range.
+         * @param end Bit-index after the last bit of the range.
+         * @param value On (true) or off (false).
+         */
+        inline static void setBitsInRange(byte* data, std::size_t begin, std::size_t end, bool value) {
+            if (begin >= end) {
+                return;
+            }
+            std::size_t beginByte = begin / 8;
+            const std::size_t endByte = end / 8;
+            const byte beginMask = (byte)(0xFF << (begin % 8));
+            const byte endMask = (byte)(((byte)1 << (end % 8)) - 1);
+            if (beginByte == endByte) {
+                const byte mask = beginMask & endMask;
+                data[beginByte] = value ? data[beginByte] | mask : data[beginByte] & ~mask;
+                return;
+            }
+            if (begin % 8) {
+                data[beginByte] = value ? data[beginByte] | beginMask : data[beginByte] & ~beginMask;
+                ++beginByte;
+            }
+            std::memset(data + beginByte, value ? 0xFF : 0, endByte - beginByte);
+            if (endMask) {
+                data[endByte] = value ? data[endByte] | endMask : data[endByte] & ~endMask;
+            }
+        }
+
+
         /**
          * Return the index of the lowest 'ON' bit in the byte.
          * @param b Byte value.
@@ -135,8 +464,74 @@ namespace bitlib2 {
         }
 
 
+        /**
+         * Load a 64 bit word from a byte buffer, such that bit 'i' of the word is bit 'i' of the buffer.
+         * @param data Byte data buffer (no alignment needed).
+         * @return Data word.
+         */
+        inline static unsigned long long loadWord(const byte* data) {
+            unsigned long long w;
+            std::memcpy(&w, data, sizeof(w));
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            w = __builtin_bswap64(w);
+#endif
+            return w;
+        }
+
+
+        /**
+         * Store a 64 bit word into a byte buffer, such that bit 'i' of the buffer is bit 'i' of the word.
+         * @param data Byte data buffer (no alignment needed).
+         * @param w Data word.
+         */
+        inline static void storeWord(byte* data, unsigned long long w) {
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+            w = __builtin_bswap64(w);
+#endif
+            std::memcpy(data, &w, sizeof(w));
+        }
+
+
+        /**
+         * Return the index of the lowest 'ON' bit in a 64 bit word.
+         * @param w Data word, must not be 0.
+         * @return Bit-index (between 0 and 63).
+         */
+        inline static unsigned int countTrailingZeros(unsigned long long w) {
+#if defined(__GNUC__)
+            return __builtin_ctzll(w);
+#else
+            unsigned int index = 0;
+            while (!(w & 0xFF)) {
+                w >>= 8;
+                index += 8;
+            }
+            return index + getLeastSignificantOnBitIndex(w & 0xFF);
+#endif
+        }
+
+
+        /**
+         * Return the index of the highest 'ON' bit in a 64 bit word.
+         * @param w Data word, must not be 0.
+         * @return Bit-index (between 0 and 63).
+         */
+        inline static unsigned int getMostSignificantOnBitIndex(unsigned long long w) {
+#if defined(__GNUC__)
+            return 63 - __builtin_clzll(w);
+#else
+            unsigned int index = 0;
+            while (w >>= 1) {
+                ++index;
+            }
+            return index;
+#endif
+        }
+
+
         /**
          * Return the next bit-index where a bit with given value is found.
+         * Note: Scans a 64 bit word at a time and skips four words at a time while there is no match.
          * @param byteData Byte data buffer. Should not be NULL.
          * @param byteCount Buffer byte count.
          * @param startIndex Start index.
@@ -144,26 +539,232 @@ namespace bitlib2 {
          * @return Next bit-index or -1 if not found.
          */
         inline static std::size_t getNextBitWithValue(const byte* byteData, const std::size_t byteCount, const std::size_t startIndex, bool value) {
-            std::size_t byteIndex = startIndex / 8;
-            byte b = (value ? byteData[byteIndex] : ~byteData[byteIndex]) >> (startIndex % 8);
-            if (b) {
-                return util::getLeastSignificantOnBitIndex(b) + startIndex;
+            const unsigned long long flip = value ? 0 : ~0ULL;
+            const std::size_t wordCount = byteCount / 8;
+            std::size_t wordIndex = startIndex / 64;
+            if (wordIndex < wordCount) {
+                const unsigned long long w = (loadWord(byteData + wordIndex * 8) ^ flip) >> (startIndex % 64);
+                if (w) {
+                    return startIndex + countTrailingZeros(w);
+                }
+                for (++wordIndex; wordIndex + 4 <= wordCount; wordIndex += 4) {
+                    const byte* const data = byteData + wordIndex * 8;
+                    const unsigned long long w0 = loadWord(data) ^ flip;
+                    const unsigned long long w1 = loadWord(data + 8) ^ flip;
+                    const unsigned long long w2 = loadWord(data + 16) ^ flip;
+                    const unsigned long long w3 = loadWord(data + 24) ^ flip;
+                    if (w0 | w1 | w2 | w3) {
+                        if (w0) {
+                            return wordIndex * 64 + countTrailingZeros(w0);
+                        }
+                        else if (w1) {
+                            return wordIndex * 64 + 64 + countTrailingZeros(w1);
+                        }
+                        else if (w2) {
+                            return wordIndex * 64 + 128 + countTrailingZeros(w2);
+                        }
+                        return wordIndex * 64 + 192 + countTrailingZeros(w3);
+                    }
+                }
+                for (; wordIndex < wordCount; ++wordIndex) {
+                    const unsigned long long w = loadWord(byteData + wordIndex * 8) ^ flip;
+                    if (w) {
+                        return wordIndex * 64 + countTrailingZeros(w);
+                    }
+                }
             }
-            if (value) {
+
+            // Remaining bytes after the last full word:
+            const std::size_t bitIndex = startIndex > wordCount * 64 ? startIndex : wordCount * 64;
+            std::size_t byteIndex = bitIndex / 8;
+            if (byteIndex < byteCount) {
+                byte b = (value ? byteData[byteIndex] : ~byteData[byteIndex]) >> (bitIndex % 8);
+                if (b) {
+                    return util::getLeastSignificantOnBitIndex(b) + bitIndex;
+                }
                 while (++byteIndex < byteCount) {
-                    b = byteData[byteIndex];
+                    b = value ? byteData[byteIndex] : ~byteData[byteIndex];
                     if (b) {
                         return util::getLeastSignificantOnBitIndex(b) + (byteIndex * 8);
                     }
                 }
             }
-            else {
-                while (++byteIndex < byteCount) {
-                    b = ~byteData[byteIndex];
+            return -1;
+        }
+
+
+        /**
+         * Return the previous bit-index (searching downwards) where a bit with given value is found.
+         * Note: Scans a 64 bit word at a time and skips four words at a time while there is no match.
+         * @param byteData Byte data buffer. Should not be NULL.
+         * @param byteCount Buffer byte count.
+         * @param startIndex Start index (included in the search), must be less than byteCount * 8.
+         * @param value Value to look for.
+         * @return Previous bit-index or -1 if not found.
+         */
+        inline static std::size_t getPrevBitWithValue(const byte* byteData, const std::size_t byteCount, const std::size_t startIndex, bool value) {
+            const unsigned long long flip = value ? 0 : ~0ULL;
+            const std::size_t wordCount = byteCount / 8;
+            std::size_t wordIndex = startIndex / 64;
+
+            // Remaining bytes after the last full word:
+            if (wordIndex >= wordCount) {
+                std::size_t byteIndex = startIndex / 8;
+                const byte mask = (byte)(2 << (startIndex % 8)) - 1;
+                byte b = (value ? byteData[byteIndex] : ~byteData[byteIndex]) & mask;
+                while (true) {
                     if (b) {
-                        return util::getLeastSignificantOnBitIndex(b) + (byteIndex * 8);
+                        return byteIndex * 8 + getMostSignificantOnBitIndex(b);
+                    }
+                    if (byteIndex == wordCount * 8) {
+                        break;
+                    }
+                    --byteIndex;
+                    b = value ? byteData[byteIndex] : ~byteData[byteIndex];
+                }
+                if (wordCount == 0) {
+                    return -1;
+                }
+                wordIndex = wordCount - 1;
+            }
+            else {
+                const unsigned long long w = (loadWord(byteData + wordIndex * 8) ^ flip) & (~0ULL >> (63 - startIndex % 64));
+                if (w) {
+                    return wordIndex * 64 + getMostSignificantOnBitIndex(w);
+                }
+                if (wordIndex == 0) {
+                    return -1;
+                }
+                --wordIndex;
+            }
+
+            for (; wordIndex >= 3; wordIndex -= 4) {
+                const byte* const data = byteData + (wordIndex - 3) * 8;
+                const unsigned long long w0 = loadWord(data) ^ flip;
+                const unsigned long long w1 = loadWord(data + 8) ^ flip;
+                const unsigned long long w2 = loadWord(data + 16) ^ flip;
+                const unsigned long long w3 = loadWord(data + 24) ^ flip;
+                if (w0 | w1 | w2 | w3) {
+                    if (w3) {
+                        return wordIndex * 64 + getMostSignificantOnBitIndex(w3);
+                    }
+                    else if (w2) {
+                        return wordIndex * 64 - 64 + getMostSignificantOnBitIndex(w2);
+                    }
+                    else if (w1) {
+                        return wordIndex * 64 - 128 + getMostSignificantOnBitIndex(w1);
+                    }
+                    return wordIndex * 64 - 192 + getMostSignificantOnBitIndex(w0);
+                }
+                if (wordIndex == 3) {
+                    return -1;
+                }
+            }
+            for (++wordIndex; wordIndex-- > 0; ) {
+                const unsigned long long w = loadWord(byteData + wordIndex * 8) ^ flip;
+                if (w) {
+                    return wordIndex * 64 + getMostSignificantOnBitIndex(w);
+                }
+            }
+            return -1;
+        }
+
+
+#ifdef BITLIB2_X86_DISPATCH
+        /**
+         * Return the index of the 'ON' bit with given rank in a 64 bit word, with the PDEP instruction.
+         * @param w Data word.
+         * @param rank Rank of the bit (counting from 0), must be less than the number of 'ON' bits in w.
+         * @return Bit-index (between 0 and 63).
+         */
+        BITLIB2_TARGET("bmi2")
+        inline static unsigned int selectInWordPdep(unsigned long long w, unsigned int rank) {
+            return countTrailingZeros(_pdep_u64(1ULL << rank, w));
+        }
+#endif
+
+
+        /**
+         * Return the index of the 'ON' bit with given rank in a 64 bit word, a byte at a time.
+         * @param w Data word.
+         * @param rank Rank of the bit (counting from 0), must be less than the number of 'ON' bits in w.
+         * @return Bit-index (between 0 and 63).
+         */
+        inline static unsigned int selectInWordPortable(unsigned long long w, unsigned int rank) {
+            unsigned int index = 0;
+            byte b = w & 0xFF;
+            for (unsigned int c = countBitsInByte(b); rank >= c; c = countBitsInByte(b)) {
+                rank -= c;
+                w >>= 8;
+                index += 8;
+                b = w & 0xFF;
+            }
+            for (; rank > 0; --rank) {
+                b &= b - 1;
+            }
+            return index + getLeastSignificantOnBitIndex(b);
+        }
+
+
+        /**
+         * Return the index of the 'ON' bit with given rank in a 64 bit word.
+         * @param w Data word.
+         * @param rank Rank of the bit (counting from 0), must be less than the number of 'ON' bits in w.
+         * @return Bit-index (between 0 and 63).
+         */
+        inline static unsigned int selectInWord(unsigned long long w, unsigned int rank) {
+#ifdef BITLIB2_X86_DISPATCH
+            if (CpuFeatures::get().bmi2) {
+                return selectInWordPdep(w, rank);
+            }
+#endif
+            return selectInWordPortable(w, rank);
+        }
+
+
+        /**
+         * Return the bit-index of the bit with given value and rank, counting from a start index.
+         * @param byteData Byte data buffer. Should not be NULL.
+         * @param byteCount Buffer byte count.
+         * @param startIndex Start index.
+         * @param rank Number of bits with the value to skip, starting at startIndex.
+         * @param value Value to look for.
+         * @return Bit-index or -1 if not found.
+         */
+        inline static std::size_t selectBitWithValue(const byte* byteData, const std::size_t byteCount, const std::size_t startIndex, std::size_t rank, bool value) {
+            const unsigned long long flip = value ? 0 : ~0ULL;
+            const std::size_t wordCount = byteCount / 8;
+            std::size_t wordIndex = startIndex / 64;
+            if (wordIndex < wordCount) {
+                unsigned long long w = (loadWord(byteData + wordIndex * 8) ^ flip) & (~0ULL << (startIndex % 64));
+                while (true) {
+                    const std::size_t c = countBitsInWord(w);
+                    if (rank < c) {
+                        return wordIndex * 64 + selectInWord(w, rank);
+                    }
+                    rank -= c;
+                    if (++wordIndex == wordCount) {
+                        break;
+                    }
+                    w = loadWord(byteData + wordIndex * 8) ^ flip;
+                }
+            }
+
+            // Remaining bytes after the last full word:
+            const std::size_t bitIndex = startIndex > wordCount * 64 ? startIndex : wordCount * 64;
+            for (std::size_t byteIndex = bitIndex / 8; byteIndex < byteCount; ++byteIndex) {
+                byte b = value ? byteData[byteIndex] : ~byteData[byteIndex];
+                if (byteIndex == bitIndex / 8) {
+                    b &= (byte)(0xFF << (bitIndex % 8));
+                }
+                const std::size_t c = countBitsInByte(b);
+                if (rank < c) {
+                    for (; rank > 0; --rank) {
+                        b &= b - 1;
                     }
+                    return byteIndex * 8 + getLeastSignificantOnBitIndex(b);
                 }
+                rank -= c;
             }
             return -1;
         }
@@ -280,6 +881,19 @@ namespace bitlib2 {
     template <> struct BitOperandType<8> { typedef unsigned char type; };
 
 
+    /**
+     * Operand type wider than the native integer types (used by SIMD bit-operations).
+     */
+    template <int BitSize>
+    struct WideOperand {
+        unsigned long long parts[BitSize / 64];
+    };
+
+    template <> struct BitOperandType<512> { typedef WideOperand<512> type; };
+    template <> struct BitOperandType<256> { typedef WideOperand<256> type; };
+    template <> struct BitOperandType<128> { typedef WideOperand<128> type; };
+
+
     /**
      * Serializer interface
      */
@@ -325,6 +939,23 @@ namespace bitlib2 {
              * @param bytesCount Number of empty bytes.
              */
             virtual void addEmptyBytes(std::size_t bytesCount) = 0;
+
+            /**
+             * Add bit data given as runs of 'ON' bits.
+             * Note: The default implementation expands the runs and adds them with addBytes().
+             * @param runs Pairs of the first and last bit index of every run, in increasing order
+             *        and with at least one 'OFF' bit between runs.
+             * @param runCount Number of runs.
+             * @param bytesCount Number of bytes covered by the runs.
+             * @param onBitCount Number of 'ON' bits in the runs.
+             */
+            virtual void addRuns(const unsigned short* runs, std::size_t runCount, std::size_t bytesCount, std::size_t onBitCount) {
+                std::vector<byte> data(bytesCount);
+                for (std::size_t i = 0; i < runCount; ++i) {
+                    util::setBitsInRange(&data[0], runs[2 * i], runs[2 * i + 1] + 1, true);
+                }
+                this->addBytes(&data[0], bytesCount, onBitCount);
+            }
     };
 
 
@@ -360,6 +991,37 @@ namespace bitlib2 {
              */
             virtual bool getBytes(byte* data, std::size_t bytesCount, bool& empty) = 0;
 
+            /**
+             * Check whether the next bit data are runs of 'ON' bits (see ISerializer::addRuns()) covering
+             * exactly a given number of bytes, which can then be read with getRuns().
+             * Note: The default implementation never returns runs; they are read with getBytes() instead.
+             * @param bytesCount Number of bytes the runs have to cover.
+             * @return Number of runs or -1 if the next data are no such runs.
+             */
+            virtual std::size_t getRunCount(std::size_t bytesCount) {
+                (void)bytesCount;
+                return (std::size_t)-1;
+            }
+
+            /**
+             * Deserialize the runs announced by getRunCount().
+             * @param runs Buffer for the pairs of the first and last bit index of every run.
+             */
+            virtual void getRuns(unsigned short* runs) {
+                (void)runs;
+            }
+
+            /**
+             * Skip the next bit data if they are empty, in whole numbers of blocks.
+             * Note: The default implementation skips nothing; empty blocks are read with getBytes() instead.
+             * @param bytesCount Number of bytes per block.
+             * @return Number of empty blocks skipped.
+             */
+            virtual std::size_t skipEmptyBlocks(std::size_t bytesCount) {
+                (void)bytesCount;
+                return 0;
+            }
+
             /**
              * Check whether something failed during deserialization upto now.
              * @return Failure (true) or no failure (false).
@@ -408,7 +1070,7 @@ namespace bitlib2 {
              */
             BitBlockData(const BitBlockData& other) :
                 block(other.block),
-                refCounter(other.block ? other.refCounter : _RefCounter())
+                refCounter(other.block && !other.isFull() ? other.refCounter : _RefCounter())
             {
             }
 
@@ -417,7 +1079,7 @@ namespace bitlib2 {
              * @destructor
              */
             ~BitBlockData() {
-                if (this->block && this->refCounter.getCount() == 1) {
+                if (this->block && !this->isFull() && this->refCounter.getCount() == 1) {
                     getDataAllocatorInstance().deallocate(this->block, 1);
                 }
             }
@@ -429,17 +1091,45 @@ namespace bitlib2 {
              * @return This instance.
              */
             BitBlockData& operator=(const BitBlockData& other) {
-                if (this->block && this->refCounter.getCount() == 1) {
+                if (this == &other) {
+                    return *this;
+                }
+                if (this->block && !this->isFull() && this->refCounter.getCount() == 1) {
                     getDataAllocatorInstance().deallocate(this->block, 1);
                 }
                 this->block = other.block;
-                if (this->block) {
+                if (this->block && !other.isFull()) {
                     this->refCounter = other.refCounter;
                 }
+                else {
+                    this->refCounter.reset();
+                }
                 return *this;
             }
 
 
+            /**
+             * Get block data with all bits 'ON'.
+             * Note: All such instances share one static, never deallocated, data block, without
+             *       reference counting. It is copied on the first write, like shared data.
+             * @return Block data.
+             */
+            static BitBlockData full() {
+                BitBlockData fullData;
+                fullData.block = getFullBlock();
+                return fullData;
+            }
+
+
+            /**
+             * Check whether this is the shared block data with all bits 'ON' (see full()).
+             * @return True iff full.
+             */
+            bool isFull() const {
+                return this->block == getFullBlock();
+            }
+
+
             /**
              * Get the block data.
              * @return The data block or NULL.
@@ -458,7 +1148,7 @@ namespace bitlib2 {
                 if (!this->block) {
                     this->allocate();
                 }
-                else if (this->refCounter.getCount() != 1) {
+                else if (this->isFull() || this->refCounter.getCount() != 1) {
                     this->allocate();
                     this->refCounter.reset();
                 }
@@ -481,6 +1171,17 @@ namespace bitlib2 {
             }
 
 
+            /**
+             * Return the static data block with all bits 'ON'.
+             */
+            static Block* getFullBlock() {
+                static Block fullBlock;
+                static const bool initialized = (std::memset(fullBlock.data, 0xFF, BlockByteCount), true);
+                (void)initialized;
+                return &fullBlock;
+            }
+
+
             /**
              * Return the singleton allocator instance for block data.
              */
@@ -494,11 +1195,229 @@ namespace bitlib2 {
     };
 
 
-    namespace operation {
+    /**
+     * A sorted array of bit positions managed with a reference counter; the container of sparse bit-blocks.
+     * Note: The reference count, size, capacity and kind of the array are kept in a header in front of
+     *       the positions, in the same allocation, so an array costs a single pointer in a block and
+     *       sharing it needs no extra counter allocation.
+     */
+    template <
+        int MaxSize,
+        typename _AllocatorSelector
+    >
+    class BitBlockArray
+    {
+        public:
+            typedef unsigned short PositionType;
 
-        enum {
-            AND = 0,
-            AND_INV,
+        private:
+            struct Header {
+                std::size_t refCount;
+                unsigned short size;
+                unsigned short capacity;
+                bool runs; // The positions are first and last positions of runs.
+            };
+            typedef typename _AllocatorSelector::template BitBlockDataAllocator<Header>::type HeaderAllocator;
+
+        public:
+            /**
+             * @constructor
+             */
+            BitBlockArray() :
+                header(NULL)
+            {
+            }
+
+
+            /**
+             * @constructor
+             * Copy constructor.
+             * @param other Other array.
+             */
+            BitBlockArray(const BitBlockArray& other) :
+                header(other.header)
+            {
+                if (this->header) {
+                    this->header->refCount += 1;
+                }
+            }
+
+
+            /**
+             * @destructor
+             */
+            ~BitBlockArray() {
+                this->release();
+            }
+
+
+            /**
+             * Assignment.
+             * @param other Other array.
+             * @return This instance.
+             */
+            BitBlockArray& operator=(const BitBlockArray& other) {
+                if (this->header == other.header) {
+                    return *this;
+                }
+                this->release();
+                this->header = other.header;
+                if (this->header) {
+                    this->header->refCount += 1;
+                }
+                return *this;
+            }
+
+
+            /**
+             * Get the positions, in increasing order.
+             * @return The positions or NULL.
+             */
+            const PositionType* getPositions() const {
+                return this->header ? getPositions(this->header) : NULL;
+            }
+
+
+            /**
+             * Get the number of positions.
+             * @return Size.
+             */
+            std::size_t getSize() const {
+                return this->header ? this->header->size : 0;
+            }
+
+
+            /**
+             * Check whether the positions are the first and last positions of runs.
+             * @return True iff runs.
+             */
+            bool isRuns() const {
+                return this->header && this->header->runs;
+            }
+
+
+            /**
+             * Get the (mutable) positions, with room for at least minCapacity positions.
+             * Note: If the positions are shared with another array or there is not enough room, then
+             *       memory will be allocated and the existing positions copied over.
+             * @param minCapacity Minimum capacity (at most MaxSize).
+             * @return The positions.
+             */
+            PositionType* getMutablePositions(std::size_t minCapacity) {
+                const std::size_t capacity = this->header ? this->header->capacity : 0;
+                if (capacity < minCapacity) {
+                    this->allocate(std::min((std::size_t)MaxSize, std::max(minCapacity, capacity + capacity / 2)));
+                }
+                else if (this->header && this->header->refCount != 1) {
+                    this->allocate(capacity);
+                }
+                return this->header ? getPositions(this->header) : NULL;
+            }
+
+
+            /**
+             * Set the number of positions, after writing them via getMutablePositions().
+             * @param size Size (at most the capacity).
+             */
+            void setSize(std::size_t size) {
+                if (this->header) {
+                    this->header->size = (unsigned short)size;
+                }
+            }
+
+
+            /**
+             * Mark the positions as runs or not, after writing them via getMutablePositions().
+             * @param runs Runs (true) or single positions (false).
+             */
+            void setRuns(bool runs) {
+                if (this->header) {
+                    this->header->runs = runs;
+                }
+            }
+
+
+            /**
+             * Release the positions, making this an empty array.
+             */
+            void clear() {
+                this->release();
+            }
+
+        private:
+            /**
+             * Allocate memory for the positions.
+             * Note: Existing (shared) positions will be copied over. Throws std::bad_alloc if the
+             *       allocator returns no memory; the array is unchanged then.
+             * @param newCapacity Capacity (at least the size).
+             */
+            void allocate(std::size_t newCapacity) {
+                void* const headerMem = getHeaderAllocatorInstance().allocate(getHeaderCount(newCapacity), NULL);
+                if (!headerMem) {
+                    throw std::bad_alloc();
+                }
+                Header* const newHeader = new(headerMem) Header();
+                newHeader->refCount = 1;
+                newHeader->capacity = (unsigned short)newCapacity;
+                if (this->header) {
+                    newHeader->size = this->header->size;
+                    newHeader->runs = this->header->runs;
+                    std::memcpy(getPositions(newHeader), getPositions(this->header), this->header->size * sizeof(PositionType));
+                }
+                this->release();
+                this->header = newHeader;
+            }
+
+
+            /**
+             * Drop this array's reference to the positions, deallocating them if not shared with another array.
+             */
+            void release() {
+                if (this->header) {
+                    if (this->header->refCount == 1) {
+                        getHeaderAllocatorInstance().deallocate(this->header, getHeaderCount(this->header->capacity));
+                    }
+                    else {
+                        this->header->refCount -= 1;
+                    }
+                    this->header = NULL;
+                }
+            }
+
+
+            /**
+             * Get the positions following a header.
+             */
+            static PositionType* getPositions(Header* header) {
+                return reinterpret_cast<PositionType*>(header + 1);
+            }
+
+
+            /**
+             * Get the number of header-sized units holding a header and the positions.
+             */
+            static std::size_t getHeaderCount(std::size_t capacity) {
+                return 1 + (capacity * sizeof(PositionType) + sizeof(Header) - 1) / sizeof(Header);
+            }
+
+
+            /**
+             * Return the singleton allocator instance for positions.
+             */
+            static HeaderAllocator& getHeaderAllocatorInstance() {
+                static HeaderAllocator allocator;
+                return allocator;
+            }
+
+            Header* header;
+    };
+
+
+    namespace operation {
+
+        enum {
+            AND = 0,
+            AND_INV,
             INV_AND,
             OR,
             XOR,
@@ -540,6 +1459,55 @@ namespace bitlib2 {
         };
 
 
+        /**
+         * Number of bytes per chunk for the chunked operate-and-count implementations. Small enough for a
+         * chunk to still be in L1 cache when it is counted.
+         */
+        static const std::size_t COUNT_CHUNK_BYTE_LENGTH = 1024;
+
+
+        /**
+         * Perform a bitwise operation and count the 'ON' bits of the result, chunk by chunk.
+         * @param block1 First operand and result.
+         * @param block2 Second operand.
+         * @param byteLength Length of the operands in bytes.
+         * @return Number of 'ON' bits in the result.
+         */
+        template <typename _BitOpImpl, int Operation>
+        inline static std::size_t executeAndCountInChunks(byte* block1, const byte* block2, const std::size_t byteLength) {
+            std::size_t count = 0;
+            for (std::size_t offset = 0; offset < byteLength; offset += COUNT_CHUNK_BYTE_LENGTH) {
+                const std::size_t length = byteLength - offset < COUNT_CHUNK_BYTE_LENGTH ? byteLength - offset : COUNT_CHUNK_BYTE_LENGTH;
+                _BitOpImpl::template executeRange<Operation>(block1 + offset, block2 + offset, length);
+                count += util::countBitsInBytes(block1 + offset, length);
+            }
+            return count;
+        }
+
+
+        /**
+         * Count the 'ON' bits of the result of a bitwise operation without modifying the operands.
+         * Each chunk is computed in a buffer on the stack.
+         * @param block1 First operand.
+         * @param block2 Second operand.
+         * @param byteLength Length of the operands in bytes.
+         * @return Number of 'ON' bits in the result.
+         */
+        template <typename _BitOpImpl, int Operation>
+        inline static std::size_t countInChunks(const byte* block1, const byte* block2, const std::size_t byteLength) {
+            unsigned long long buffer[COUNT_CHUNK_BYTE_LENGTH / sizeof(unsigned long long)];
+            byte* const result = reinterpret_cast<byte*>(buffer);
+            std::size_t count = 0;
+            for (std::size_t offset = 0; offset < byteLength; offset += COUNT_CHUNK_BYTE_LENGTH) {
+                const std::size_t length = byteLength - offset < COUNT_CHUNK_BYTE_LENGTH ? byteLength - offset : COUNT_CHUNK_BYTE_LENGTH;
+                std::memcpy(result, block1 + offset, length);
+                _BitOpImpl::template executeRange<Operation>(result, block2 + offset, length);
+                count += util::countBitsInBytes(result, length);
+            }
+            return count;
+        }
+
+
         /**
          * Default bitwise operation implementations.
          */
@@ -550,16 +1518,323 @@ namespace bitlib2 {
             typedef typename BitOperandType<_OperandTypeSize>::type OperandType;
 
             template <int Operation, int ByteLength> static void execute(byte* block1, const byte* block2) {
+                executeRange<Operation>(block1, block2, ByteLength);
+            }
+
+            template <int Operation, int ByteLength> static std::size_t executeAndCount(byte* block1, const byte* block2) {
+                return executeAndCountInChunks<DefaultBitOp, Operation>(block1, block2, ByteLength);
+            }
+
+            template <int Operation, int ByteLength> static std::size_t count(const byte* block1, const byte* block2) {
+                return countInChunks<DefaultBitOp, Operation>(block1, block2, ByteLength);
+            }
+
+            template <int Operation> static void executeRange(byte* block1, const byte* block2, const std::size_t byteLength) {
                 OperandType* op1 = reinterpret_cast<OperandType*>(block1);
                 const OperandType* op2 = reinterpret_cast<const OperandType*>(block2);
-                const OperandType* const op2End = op2 + (ByteLength / sizeof(OperandType));
+                const OperandType* const op2End = op2 + (byteLength / sizeof(OperandType));
                 while (op2 < op2End) {
                     DefaultBitOpExecuter<Operation>::exec(*op1, *op2);
                     op1++;
                     op2++;
                 }
-            } 
+            }
+
+        };
+
+
+#ifdef BITLIB2_X86_DISPATCH
+        template <int Operation> struct SimdBitOpExecuter;
+
+        template <> struct SimdBitOpExecuter<AND> {
+            BITLIB2_TARGET("sse2") static __m128i exec(const __m128i op1, const __m128i op2) {
+                return _mm_and_si128(op1, op2);
+            }
+            BITLIB2_TARGET("avx2") static __m256i exec(const __m256i op1, const __m256i op2) {
+                return _mm256_and_si256(op1, op2);
+            }
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+            BITLIB2_TARGET("avx512f") static __m512i exec(const __m512i op1, const __m512i op2) {
+                return _mm512_and_si512(op1, op2);
+            }
+#endif
+        };
+
+        template <> struct SimdBitOpExecuter<AND_INV> {
+            BITLIB2_TARGET("sse2") static __m128i exec(const __m128i op1, const __m128i op2) {
+                return _mm_andnot_si128(op2, op1);
+            }
+            BITLIB2_TARGET("avx2") static __m256i exec(const __m256i op1, const __m256i op2) {
+                return _mm256_andnot_si256(op2, op1);
+            }
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+            BITLIB2_TARGET("avx512f") static __m512i exec(const __m512i op1, const __m512i op2) {
+                // op1 & ~op2 as a truth table over (op1, op2, op2); _mm512_andnot_si512 starts from an undefined value.
+                return _mm512_ternarylogic_epi64(op1, op2, op2, 0x30);
+            }
+#endif
+        };
+
+        template <> struct SimdBitOpExecuter<INV_AND> {
+            BITLIB2_TARGET("sse2") static __m128i exec(const __m128i op1, const __m128i op2) {
+                return _mm_andnot_si128(op1, op2);
+            }
+            BITLIB2_TARGET("avx2") static __m256i exec(const __m256i op1, const __m256i op2) {
+                return _mm256_andnot_si256(op1, op2);
+            }
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+            BITLIB2_TARGET("avx512f") static __m512i exec(const __m512i op1, const __m512i op2) {
+                // ~op1 & op2 as a truth table over (op1, op2, op2).
+                return _mm512_ternarylogic_epi64(op1, op2, op2, 0x0C);
+            }
+#endif
+        };
+
+        template <> struct SimdBitOpExecuter<OR> {
+            BITLIB2_TARGET("sse2") static __m128i exec(const __m128i op1, const __m128i op2) {
+                return _mm_or_si128(op1, op2);
+            }
+            BITLIB2_TARGET("avx2") static __m256i exec(const __m256i op1, const __m256i op2) {
+                return _mm256_or_si256(op1, op2);
+            }
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+            BITLIB2_TARGET("avx512f") static __m512i exec(const __m512i op1, const __m512i op2) {
+                return _mm512_or_si512(op1, op2);
+            }
+#endif
+        };
+
+        template <> struct SimdBitOpExecuter<XOR> {
+            BITLIB2_TARGET("sse2") static __m128i exec(const __m128i op1, const __m128i op2) {
+                return _mm_xor_si128(op1, op2);
+            }
+            BITLIB2_TARGET("avx2") static __m256i exec(const __m256i op1, const __m256i op2) {
+                return _mm256_xor_si256(op1, op2);
+            }
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+            BITLIB2_TARGET("avx512f") static __m512i exec(const __m512i op1, const __m512i op2) {
+                return _mm512_xor_si512(op1, op2);
+            }
+#endif
+        };
+#endif
+
+
+        /**
+         * SIMD bitwise operation implementations (SSE2, AVX2 or AVX-512 for operand sizes 128, 256 or 512).
+         * Note: The widest instruction set supported by both the operand size and the CPU is used. Loops are
+         *       unrolled four times. Without x86 SIMD support the operations fall back to DefaultBitOp<64>.
+         */
+        template <int _OperandTypeSize>
+        struct SimdBitOp
+        {
+            enum { OperandTypeSize = _OperandTypeSize };
+            typedef typename BitOperandType<_OperandTypeSize>::type OperandType;
+
+            template <int Operation, int ByteLength> static void execute(byte* block1, const byte* block2) {
+                executeRange<Operation>(block1, block2, ByteLength);
+            }
+
+            template <int Operation, int ByteLength> static std::size_t executeAndCount(byte* block1, const byte* block2) {
+#ifdef BITLIB2_X86_DISPATCH
+                const util::CpuFeatures& cpu = util::CpuFeatures::get();
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+                if (_OperandTypeSize >= 512 && cpu.avx512vpopcntdq) {
+                    return countAvx512<Operation, true>(block1, block2, block1, ByteLength);
+                }
+#endif
+                if (_OperandTypeSize >= 256 && cpu.avx2) {
+                    return countAvx2<Operation, true>(block1, block2, block1, ByteLength);
+                }
+#endif
+                return executeAndCountInChunks<SimdBitOp, Operation>(block1, block2, ByteLength);
+            }
+
+            template <int Operation, int ByteLength> static std::size_t count(const byte* block1, const byte* block2) {
+#ifdef BITLIB2_X86_DISPATCH
+                const util::CpuFeatures& cpu = util::CpuFeatures::get();
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+                if (_OperandTypeSize >= 512 && cpu.avx512vpopcntdq) {
+                    return countAvx512<Operation, false>(block1, block2, NULL, ByteLength);
+                }
+#endif
+                if (_OperandTypeSize >= 256 && cpu.avx2) {
+                    return countAvx2<Operation, false>(block1, block2, NULL, ByteLength);
+                }
+#endif
+                return countInChunks<SimdBitOp, Operation>(block1, block2, ByteLength);
+            }
+
+            template <int Operation> static void executeRange(byte* block1, const byte* block2, const std::size_t byteLength) {
+#ifdef BITLIB2_X86_DISPATCH
+                const util::CpuFeatures& cpu = util::CpuFeatures::get();
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+                if (_OperandTypeSize >= 512 && cpu.avx512f) {
+                    executeAvx512<Operation>(block1, block2, byteLength);
+                    return;
+                }
+#endif
+                if (_OperandTypeSize >= 256 && cpu.avx2) {
+                    executeAvx2<Operation>(block1, block2, byteLength);
+                    return;
+                }
+                executeSse2<Operation>(block1, block2, byteLength);
+#else
+                DefaultBitOp<64>::template executeRange<Operation>(block1, block2, byteLength);
+#endif
+            }
+
+#ifdef BITLIB2_X86_DISPATCH
+            private:
+                template <int Operation>
+                BITLIB2_TARGET("sse2")
+                static void executeSse2(byte* block1, const byte* block2, const std::size_t byteLength) {
+                    __m128i* const op1 = reinterpret_cast<__m128i*>(block1);
+                    const __m128i* const op2 = reinterpret_cast<const __m128i*>(block2);
+                    const std::size_t length = byteLength / sizeof(__m128i);
+                    const std::size_t unrolledLength = length - length % 4;
+                    std::size_t i = 0;
+                    for (; i < unrolledLength; i += 4) {
+                        const __m128i r0 = SimdBitOpExecuter<Operation>::exec(_mm_loadu_si128(op1 + i), _mm_loadu_si128(op2 + i));
+                        const __m128i r1 = SimdBitOpExecuter<Operation>::exec(_mm_loadu_si128(op1 + i + 1), _mm_loadu_si128(op2 + i + 1));
+                        const __m128i r2 = SimdBitOpExecuter<Operation>::exec(_mm_loadu_si128(op1 + i + 2), _mm_loadu_si128(op2 + i + 2));
+                        const __m128i r3 = SimdBitOpExecuter<Operation>::exec(_mm_loadu_si128(op1 + i + 3), _mm_loadu_si128(op2 + i + 3));
+                        _mm_storeu_si128(op1 + i, r0);
+                        _mm_storeu_si128(op1 + i + 1, r1);
+                        _mm_storeu_si128(op1 + i + 2, r2);
+                        _mm_storeu_si128(op1 + i + 3, r3);
+                    }
+                    for (; i < length; ++i) {
+                        _mm_storeu_si128(op1 + i, SimdBitOpExecuter<Operation>::exec(_mm_loadu_si128(op1 + i), _mm_loadu_si128(op2 + i)));
+                    }
+                }
+
+
+                template <int Operation>
+                BITLIB2_TARGET("avx2")
+                static void executeAvx2(byte* block1, const byte* block2, const std::size_t byteLength) {
+                    __m256i* const op1 = reinterpret_cast<__m256i*>(block1);
+                    const __m256i* const op2 = reinterpret_cast<const __m256i*>(block2);
+                    const std::size_t length = byteLength / sizeof(__m256i);
+                    const std::size_t unrolledLength = length - length % 4;
+                    std::size_t i = 0;
+                    for (; i < unrolledLength; i += 4) {
+                        const __m256i r0 = SimdBitOpExecuter<Operation>::exec(_mm256_loadu_si256(op1 + i), _mm256_loadu_si256(op2 + i));
+                        const __m256i r1 = SimdBitOpExecuter<Operation>::exec(_mm256_loadu_si256(op1 + i + 1), _mm256_loadu_si256(op2 + i + 1));
+                        const __m256i r2 = SimdBitOpExecuter<Operation>::exec(_mm256_loadu_si256(op1 + i + 2), _mm256_loadu_si256(op2 + i + 2));
+                        const __m256i r3 = SimdBitOpExecuter<Operation>::exec(_mm256_loadu_si256(op1 + i + 3), _mm256_loadu_si256(op2 + i + 3));
+                        _mm256_storeu_si256(op1 + i, r0);
+                        _mm256_storeu_si256(op1 + i + 1, r1);
+                        _mm256_storeu_si256(op1 + i + 2, r2);
+                        _mm256_storeu_si256(op1 + i + 3, r3);
+                    }
+                    for (; i < length; ++i) {
+                        _mm256_storeu_si256(op1 + i, SimdBitOpExecuter<Operation>::exec(_mm256_loadu_si256(op1 + i), _mm256_loadu_si256(op2 + i)));
+                    }
+                }
+
+
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+                template <int Operation>
+                BITLIB2_TARGET("avx512f")
+                static void executeAvx512(byte* block1, const byte* block2, const std::size_t byteLength) {
+                    __m512i* const op1 = reinterpret_cast<__m512i*>(block1);
+                    const __m512i* const op2 = reinterpret_cast<const __m512i*>(block2);
+                    const std::size_t length = byteLength / sizeof(__m512i);
+                    const std::size_t unrolledLength = length - length % 4;
+                    std::size_t i = 0;
+                    for (; i < unrolledLength; i += 4) {
+                        const __m512i r0 = SimdBitOpExecuter<Operation>::exec(_mm512_loadu_si512(op1 + i), _mm512_loadu_si512(op2 + i));
+                        const __m512i r1 = SimdBitOpExecuter<Operation>::exec(_mm512_loadu_si512(op1 + i + 1), _mm512_loadu_si512(op2 + i + 1));
+                        const __m512i r2 = SimdBitOpExecuter<Operation>::exec(_mm512_loadu_si512(op1 + i + 2), _mm512_loadu_si512(op2 + i + 2));
+                        const __m512i r3 = SimdBitOpExecuter<Operation>::exec(_mm512_loadu_si512(op1 + i + 3), _mm512_loadu_si512(op2 + i + 3));
+                        _mm512_storeu_si512(op1 + i, r0);
+                        _mm512_storeu_si512(op1 + i + 1, r1);
+                        _mm512_storeu_si512(op1 + i + 2, r2);
+                        _mm512_storeu_si512(op1 + i + 3, r3);
+                    }
+                    for (; i < length; ++i) {
+                        _mm512_storeu_si512(op1 + i, SimdBitOpExecuter<Operation>::exec(_mm512_loadu_si512(op1 + i), _mm512_loadu_si512(op2 + i)));
+                    }
+                }
+#endif
+
+
+                /**
+                 * Count the result of the operation, storing the result in 'result' if Store is set.
+                 */
+                template <int Operation, bool Store>
+                BITLIB2_TARGET("avx2")
+                static std::size_t countAvx2(const byte* block1, const byte* block2, byte* result, const std::size_t byteLength) {
+                    const __m256i* const op1 = reinterpret_cast<const __m256i*>(block1);
+                    const __m256i* const op2 = reinterpret_cast<const __m256i*>(block2);
+                    __m256i* const res = reinterpret_cast<__m256i*>(result);
+                    const std::size_t length = byteLength / sizeof(__m256i);
+                    __m256i totalA = _mm256_setzero_si256();
+                    __m256i totalB = _mm256_setzero_si256();
+                    const std::size_t unrolledLength = length - length % 2;
+                    std::size_t i = 0;
+                    for (; i < unrolledLength; i += 2) {
+                        const __m256i r0 = SimdBitOpExecuter<Operation>::exec(_mm256_loadu_si256(op1 + i), _mm256_loadu_si256(op2 + i));
+                        const __m256i r1 = SimdBitOpExecuter<Operation>::exec(_mm256_loadu_si256(op1 + i + 1), _mm256_loadu_si256(op2 + i + 1));
+                        if (Store) {
+                            _mm256_storeu_si256(res + i, r0);
+                            _mm256_storeu_si256(res + i + 1, r1);
+                        }
+                        totalA = _mm256_add_epi64(totalA, util::countBitsAvx2(r0));
+                        totalB = _mm256_add_epi64(totalB, util::countBitsAvx2(r1));
+                    }
+                    for (; i < length; ++i) {
+                        const __m256i r = SimdBitOpExecuter<Operation>::exec(_mm256_loadu_si256(op1 + i), _mm256_loadu_si256(op2 + i));
+                        if (Store) {
+                            _mm256_storeu_si256(res + i, r);
+                        }
+                        totalA = _mm256_add_epi64(totalA, util::countBitsAvx2(r));
+                    }
+                    unsigned long long lanes[4];
+                    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), _mm256_add_epi64(totalA, totalB));
+                    return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+                }
 
+
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+                /**
+                 * Count the result of the operation, storing the result in 'result' if Store is set.
+                 */
+                template <int Operation, bool Store>
+                BITLIB2_TARGET("avx512f,avx512vpopcntdq")
+                static std::size_t countAvx512(const byte* block1, const byte* block2, byte* result, const std::size_t byteLength) {
+                    const __m512i* const op1 = reinterpret_cast<const __m512i*>(block1);
+                    const __m512i* const op2 = reinterpret_cast<const __m512i*>(block2);
+                    __m512i* const res = reinterpret_cast<__m512i*>(result);
+                    const std::size_t length = byteLength / sizeof(__m512i);
+                    __m512i totalA = _mm512_setzero_si512();
+                    __m512i totalB = _mm512_setzero_si512();
+                    const std::size_t unrolledLength = length - length % 2;
+                    std::size_t i = 0;
+                    for (; i < unrolledLength; i += 2) {
+                        const __m512i r0 = SimdBitOpExecuter<Operation>::exec(_mm512_loadu_si512(op1 + i), _mm512_loadu_si512(op2 + i));
+                        const __m512i r1 = SimdBitOpExecuter<Operation>::exec(_mm512_loadu_si512(op1 + i + 1), _mm512_loadu_si512(op2 + i + 1));
+                        if (Store) {
+                            _mm512_storeu_si512(res + i, r0);
+                            _mm512_storeu_si512(res + i + 1, r1);
+                        }
+                        totalA = _mm512_add_epi64(totalA, _mm512_popcnt_epi64(r0));
+                        totalB = _mm512_add_epi64(totalB, _mm512_popcnt_epi64(r1));
+                    }
+                    for (; i < length; ++i) {
+                        const __m512i r = SimdBitOpExecuter<Operation>::exec(_mm512_loadu_si512(op1 + i), _mm512_loadu_si512(op2 + i));
+                        if (Store) {
+                            _mm512_storeu_si512(res + i, r);
+                        }
+                        totalA = _mm512_add_epi64(totalA, _mm512_popcnt_epi64(r));
+                    }
+                    unsigned long long lanes[8];
+                    _mm512_storeu_si512(lanes, _mm512_add_epi64(totalA, totalB));
+                    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + lanes[4] + lanes[5] + lanes[6] + lanes[7];
+                }
+#endif
+#endif
         };
 
     } // namespace operation
@@ -567,6 +1842,9 @@ namespace bitlib2 {
 
     /**
      * A block of bit data with bit-operations.
+     * Note: The data is either absent (empty block), a bitmap, or, for a block with few 'ON' bits,
+     *       a sorted array of their positions, or, for a block with few runs of 'ON' bits, the first
+     *       and last position of every run. The block switches between the containers by itself.
      */
     template <
         int _BlockLength = 65536,
@@ -584,434 +1862,4068 @@ namespace bitlib2 {
                 OperandTypeLength = 1 + ((_BlockLength - 1) / (sizeof(typename _BitOpImpl::OperandType) * 8)),
                 BlockByteCount = OperandTypeLength * sizeof(typename _BitOpImpl::OperandType),
                 ActualBlockLength = BlockByteCount * 8,
+                WordCount = (BlockByteCount + 7) / 8,
+            };
+            enum {
+                // Maximum number of 'ON' bits of a block held as a sorted position array instead of
+                // a bitmap (at most as much memory as the bitmap); 0 if positions do not fit 16 bits.
+                ArrayMaxSize = ActualBlockLength <= 65536 ? BlockByteCount / 2 : 0,
+                // Maximum number of runs of 'ON' bits of a block held as pairs of positions.
+                RunMaxCount = ArrayMaxSize / 2,
             };
             typedef BitBlockData<BlockByteCount, _AllocatorSelector> _BitBlockData;
+            typedef BitBlockArray<ArrayMaxSize, _AllocatorSelector> _BitBlockArray;
+            typedef typename _BitBlockArray::PositionType PositionType;
+            static const IndexType UNKNOWN_COUNT = ~((IndexType)0);
 
 
             /**
              * @constructor
              */
-            BitBlock()
+            BitBlock() :
+                onBitCount(0)
             {
             }
 
 
             /**
              * Set the value of a bit by index.
+             * Note: Keeps the cached bit-count up to date. An empty block starts out as a position array,
+             *       which turns into a bitmap when it outgrows ArrayMaxSize, and a bitmap turns back into
+             *       a position array when cleared down to half of that. Clearing the last bit releases
+             *       the data.
              * @param index Bit index.
              * @param value On (true) or off (false).
              */
             void set(IndexType index, bool value) {
+                if (this->isRuns()) {
+                    if (this->setInRuns(index, value)) {
+                        return;
+                    }
+                    this->convertToBitmap();
+                }
+                else if (this->isArray() || (!this->data.getData() && value && ArrayMaxSize != 0)) {
+                    if (this->setInArray(index, value)) {
+                        return;
+                    }
+                    this->convertToBitmap();
+                }
                 if (!this->data.getData() && !value) {
                     return;
                 }
                 byte* block = this->data.getMutableData();
                 byte& part = block[index / 8];
-                if (value) {
-                    part |= ((byte)1 << (index % 8));
+                const byte bit = (byte)1 << (index % 8);
+                if (value == ((part & bit) != 0)) {
+                    return;
                 }
-                else {
-                    part &= ~((byte)1 << (index % 8));
+                part ^= bit;
+                if (this->onBitCount != UNKNOWN_COUNT) {
+                    this->onBitCount += value ? 1 : -1;
                 }
-            }
-
-
-            /**
-             * Get the value of a bit by index.
-             * @param index Bit index.
-             * @return On (true) or off (false).
-             */
-            bool get(IndexType index) const {
-                const byte* block = this->data.getData();
-                if (!block) {
-                    return false;
+                else if (!value) {
+                    this->count(); // Counted once, then kept up to date, to notice when the block empties.
+                }
+                if (!value && this->onBitCount <= ArrayMaxSize / 2) {
+                    this->adaptContainer();
                 }
-                return 0 != (block[index / 8] & ((byte)1 << (index % 8)));
             }
 
 
             /**
-             * Count the number of 'ON' bits in the block.
-             * @param length Include only 'length' bits in the count (default: all bits).
-             * @return Number of 'ON' bits.
+             * Set the value of multiple bits.
+             * Note: Position arrays and run containers merge up to ArrayMaxSize indexes as positions or
+             *       runs in one pass; more indexes turn them into a bitmap first. Bitmaps are copied (if shared) only
+             *       once, and all bits falling into the same 64 bit word are written at once, which is
+             *       most effective for sorted indexes.
+             * @param first Pointer to the first bit index.
+             * @param last Pointer after the last bit index.
+             * @param offset Offset to subtract from the bit indexes to get the index in the block.
+             * @param value On (true) or off (false).
              */
-            IndexType count(const IndexType length = ActualBlockLength) const {
-                const byte* const block = this->data.getData();
-                if (!block) {
-                    return 0;
+            void setMany(const IndexType* first, const IndexType* last, const IndexType offset, bool value) {
+                if (first == last || (!value && !this->hasData())) {
+                    return;
                 }
-                return util::countBits(block, std::min((IndexType)ActualBlockLength, length));
-            }
-
-
-            /**
-             * Perform bitwise AND operation.
-             * @param other Other bit-block.
-             */
-            void bitAnd(const BitBlock& other) {
-                const byte* myData = this->data.getData();
-                const byte* otherData = other.data.getData();
-                if (!myData) {
-                    // nothing to do
+                if (!this->data.getData()) {
+                    if (ArrayMaxSize != 0 && (IndexType)(last - first) <= ArrayMaxSize) {
+                        BitBlock positions;
+                        positions.assignPositions(first, last, offset, this->isRuns());
+                        if (value) {
+                            this->apply<operation::OR, false>(positions);
+                        }
+                        else {
+                            this->apply<operation::AND_INV, false>(positions);
+                        }
+                        return;
+                    }
+                    this->convertToBitmap();
                 }
-                else if (!otherData) {
-                    this->data = _BitBlockData();
+                if (!value) {
+                    this->count(); // Keep the count up to date, to notice when the block empties.
                 }
-                else {
-                    byte* const myMutableData = this->data.getMutableData();
-                    _BitOpImpl::template execute<operation::AND, BlockByteCount>(myMutableData, otherData);
+                byte* const block = this->data.getMutableData();
+                while (first != last) {
+                    const IndexType wordIndex = (*first - offset) / 64;
+                    unsigned long long mask = 0;
+                    for (; first != last && (*first - offset) / 64 == wordIndex; ++first) {
+                        mask |= 1ULL << ((*first - offset) % 64);
+                    }
+
+                    byte* const wordData = block + wordIndex * 8;
+                    if (wordIndex * 8 + 8 <= BlockByteCount) {
+                        const unsigned long long w = util::loadWord(wordData);
+                        const unsigned long long newW = value ? w | mask : w & ~mask;
+                        util::storeWord(wordData, newW);
+                        if (this->onBitCount != UNKNOWN_COUNT) {
+                            this->onBitCount += util::countBitsInWord(newW) - util::countBitsInWord(w);
+                        }
+                    }
+                    else {
+                        for (IndexType i = 0; wordIndex * 8 + i < BlockByteCount; ++i, mask >>= 8) {
+                            const byte b = wordData[i];
+                            const byte newB = value ? b | (byte)mask : b & ~(byte)mask;
+                            wordData[i] = newB;
+                            if (this->onBitCount != UNKNOWN_COUNT) {
+                                this->onBitCount += util::countBitsInByte(newB) - util::countBitsInByte(b);
+                            }
+                        }
+                    }
+                }
+                if (!value && this->onBitCount <= ArrayMaxSize / 2) {
+                    this->adaptContainer();
                 }
             }
 
 
             /**
-             * Perform bitwise AND operation with inverted second operand.
-             * @param other Other bit-block.
+             * Set all bits in a range to the same value.
+             * Note: A fully covered block is set in constant time: clearing releases the data and
+             *       filling shares the static block data with all bits 'ON'. Blocks without a bitmap
+             *       take the range as a run of 'ON' bits.
+             * @param begin First bit-index of the range.
+             * @param end Bit-index after the last bit of the range.
+             * @param value On (true) or off (false).
              */
-            void bitAndInv(const BitBlock& other) {
-                const byte* myData = this->data.getData();
-                const byte* otherData = other.data.getData();
-                if (!myData || !otherData) {
-                    // nothing to do
+            void setRange(const IndexType begin, const IndexType end, bool value) {
+                if (begin == 0 && end >= ActualBlockLength) {
+                    if (value) {
+                        this->releaseArray();
+                        this->data = _BitBlockData::full();
+                        this->onBitCount = ActualBlockLength;
+                    }
+                    else {
+                        this->clearData();
+                    }
+                    return;
                 }
-                else {
-                    byte* const myMutableData = this->data.getMutableData();
-                    _BitOpImpl::template execute<operation::AND_INV, BlockByteCount>(myMutableData, otherData);
+                if (begin >= end) {
+                    return;
+                }
+                if (this->isArray() && !value) {
+                    this->eraseFromArray(begin, end);
+                    return;
+                }
+                if (!this->data.getData() && (value || this->hasData()) && RunMaxCount != 0) {
+                    BitBlock range;
+                    range.assignRun(begin, std::min((IndexType)ActualBlockLength, end));
+                    if (value) {
+                        this->apply<operation::OR, false>(range);
+                    }
+                    else {
+                        this->apply<operation::AND_INV, false>(range);
+                    }
+                    return;
+                }
+                if (!this->data.getData() && !value) {
+                    return;
+                }
+                util::setBitsInRange(this->data.getMutableData(), begin, std::min((IndexType)ActualBlockLength, end), value);
+                this->onBitCount = UNKNOWN_COUNT;
+                if (!value) {
+                    this->adaptContainer();
                 }
             }
 
 
             /**
-             * Perform bitwise AND operation with inverted first operand.
-             * @param other Other bit-block.
+             * Assign a block-length range of the concatenation of two blocks.
+             * Note: Shares the data if the range coincides with a block, otherwise combines
+             *       64 bit words with funnel shifts.
+             * @param lower Block holding the lower bits of the concatenation (not this block).
+             * @param upper Block holding the upper bits of the concatenation (not this block).
+             * @param offset Bit index in the concatenation where the range starts (less than ActualBlockLength).
              */
-            void bitInvAnd(const BitBlock& other) {
-                const byte* otherData = other.data.getData();
-                if (!otherData) {
-                    this->data = _BitBlockData();
+            void assignConcatRange(const BitBlock& lower, const BitBlock& upper, const IndexType offset) {
+                if (offset == 0) {
+                    *this = lower;
+                    return;
                 }
-                else {
-                    byte* const myMutableData = this->data.getMutableData();
-                    _BitOpImpl::template execute<operation::INV_AND, BlockByteCount>(myMutableData, otherData);
+                if (lower.hasArray() || upper.hasArray()) {
+                    BitBlock lowerBitmap(lower);
+                    BitBlock upperBitmap(upper);
+                    lowerBitmap.convertToBitmap();
+                    upperBitmap.convertToBitmap();
+                    this->assignConcatRange(lowerBitmap, upperBitmap, offset);
+                    return;
+                }
+                const byte* const lowerData = lower.data.getData();
+                const byte* const upperData = upper.data.getData();
+                if (!lowerData && !upperData) {
+                    this->clearData();
+                    return;
+                }
+                this->releaseArray();
+                if (lower.data.isFull() && upper.data.isFull()) {
+                    this->data = _BitBlockData::full();
+                    this->onBitCount = ActualBlockLength;
+                    return;
                 }
+
+                byte* const block = this->data.getMutableData();
+                unsigned long long anyBits = 0;
+                for (IndexType wordIndex = 0; wordIndex < WordCount; ++wordIndex) {
+                    const IndexType bitIndex = offset + wordIndex * 64;
+                    unsigned long long w = getBits(lowerData, bitIndex);
+                    if (bitIndex + 64 > ActualBlockLength) {
+                        w |= bitIndex >= ActualBlockLength ? getBits(upperData, bitIndex - ActualBlockLength) : getBits(upperData, 0) << (ActualBlockLength - bitIndex);
+                    }
+                    anyBits |= w;
+                    storeWord(block, wordIndex, w);
+                }
+                if (!anyBits) {
+                    this->clearData();
+                    return;
+                }
+                this->onBitCount = UNKNOWN_COUNT;
+                this->adaptContainer();
             }
 
 
             /**
-             * Perform bitwise OR operation.
-             * @param other Other bit-block.
+             * Get the value of a bit by index.
+             * @param index Bit index.
+             * @return On (true) or off (false).
              */
-            void bitOr(const BitBlock& other) {
-                const byte* myData = this->data.getData();
-                const byte* otherData = other.data.getData();
-                if (!myData && otherData) {
-                    this->data = other.data;
+            bool get(IndexType index) const {
+                if (this->isRuns()) {
+                    const std::size_t run = this->findRun(index);
+                    return run < this->getRunCount() && this->getArrayBegin()[2 * run] <= index;
                 }
-                else if (!otherData) {
-                    // nothing to do
+                if (this->isArray()) {
+                    const PositionType* const it = this->findInArray(index);
+                    return it != this->getArrayEnd() && *it == index;
                 }
-                else {
-                    byte* const myMutableData = this->data.getMutableData();
-                    _BitOpImpl::template execute<operation::OR, BlockByteCount>(myMutableData, otherData);
+                const byte* block = this->data.getData();
+                if (!block) {
+                    return false;
                 }
+                return 0 != (block[index / 8] & ((byte)1 << (index % 8)));
             }
 
 
             /**
-             * Perform bitwise XOR operation.
-             * @param other Other bit-block.
+             * Get the values of multiple bits.
+             * @param first Pointer to the first bit index.
+             * @param last Pointer after the last bit index.
+             * @param offset Offset to subtract from the bit indexes to get the index in the block.
+             * @param flip Invert the values before output.
+             * @param output Functor called with the value of every bit, in order.
              */
-            void bitXor(const BitBlock& other) {
-                const byte* myData = this->data.getData();
-                const byte* otherData = other.data.getData();
-                if (!myData && otherData) {
-                    this->data = other.data;
+            template <typename Output>
+            void getMany(const IndexType* first, const IndexType* last, const IndexType offset, bool flip, Output& output) const {
+                if (this->hasArray()) {
+                    for (; first != last; ++first) {
+                        output(this->get(*first - offset) != flip);
+                    }
+                    return;
                 }
-                else if (!otherData) {
-                    // nothing to do
+                const byte* const block = this->data.getData();
+                if (!block) {
+                    for (; first != last; ++first) {
+                        output(flip);
+                    }
+                    return;
                 }
-                else {
-                    byte* const myMutableData = this->data.getMutableData();
-                    _BitOpImpl::template execute<operation::XOR, BlockByteCount>(myMutableData, otherData);
+                for (; first != last; ++first) {
+                    const IndexType index = *first - offset;
+                    output(((block[index / 8] >> (index % 8)) & 1) != (byte)flip);
                 }
             }
 
 
             /**
-             * Return the next bit-index where a bit with given value is found.
-             * @param startIndex Start index.
-             * @param value Value to look for.
-             * @return Next bit-index or ActualBlockLength if not found.
+             * Get a 64 bit word of the block, such that bit 'i' of the word is bit 'wordIndex * 64 + i' of the block.
+             * Note: Bits beyond the end of the block are 'OFF'.
+             * @param wordIndex Word index, must be less than WordCount.
+             * @return Data word.
              */
-            IndexType getNext(const IndexType startIndex, bool value) const {
-                const byte* byteData = this->data.getData();
-                if (!byteData) {
-                    return value ? ActualBlockLength : startIndex;
+            unsigned long long getWord(const IndexType wordIndex) const {
+                if (this->isRuns()) {
+                    const PositionType* const runs = this->getArrayBegin();
+                    const IndexType wordStart = wordIndex * 64;
+                    unsigned long long w = 0;
+                    for (std::size_t run = this->findRun(wordStart); run < this->getRunCount() && runs[2 * run] < wordStart + 64; ++run) {
+                        const IndexType first = std::max(wordStart, (IndexType)runs[2 * run]) - wordStart;
+                        const IndexType last = std::min(wordStart + 63, (IndexType)runs[2 * run + 1]) - wordStart;
+                        w |= (~0ULL >> (63 - (last - first))) << first;
+                    }
+                    return w;
                 }
-                const std::size_t nextBit = util::getNextBitWithValue(byteData, BlockByteCount, startIndex, value);
-                return nextBit == (std::size_t)-1 ? ActualBlockLength : nextBit;
+                if (this->isArray()) {
+                    const PositionType* const end = this->getArrayEnd();
+                    unsigned long long w = 0;
+                    for (const PositionType* it = this->findInArray(wordIndex * 64); it != end && *it / 64 == wordIndex; ++it) {
+                        w |= 1ULL << (*it % 64);
+                    }
+                    return w;
+                }
+                const byte* const block = this->data.getData();
+                if (!block) {
+                    return 0;
+                }
+                return loadWord(block, wordIndex);
             }
 
 
             /**
-             * Test equality of this and other bitblock (other can have different BitBlock type).
-             * @param other Other bitblock.
-             * @return Bitblocks are equal (true) or different (false).
+             * Get the mask of the bits of a 64 bit word that lie within the block.
+             * @param wordIndex Word index, must be less than WordCount.
+             * @return Bit mask.
              */
-            template <int BS, typename AS, typename BO>
-            bool operator==(const BitBlock<BS, AS, BO>& other) const {
-                if ((int)ActualBlockLength != (int)BitBlock<BS, AS, BO>::ActualBlockLength) {
-                    return false;
-                }
+            static unsigned long long getWordMask(const IndexType wordIndex) {
+                const IndexType wordEnd = wordIndex * 64 + 64;
+                return wordEnd <= ActualBlockLength ? ~0ULL : ~0ULL >> (wordEnd - ActualBlockLength);
+            }
 
-                const byte* myData = this->data.getData();
-                const byte* otherData = other.data.getData();
 
-                if (myData && otherData) {
-                    return 0 == std::memcmp(myData, otherData, BlockByteCount);
-                }
-                else if (myData) {
-                    return this->count() == 0;
-                }
-                else if (otherData) {
-                    return other.count() == 0;
-                }
+            /**
+             * Check whether the block is a full block, i.e. shares the static data with all bits 'ON'.
+             * Note: A block can have all bits 'ON' without being a full block.
+             * @return True iff full.
+             */
+            bool isFull() const {
+                return this->data.isFull();
+            }
 
-                return true;
+
+            /**
+             * Check whether the block has data, i.e. is not an empty (NULL) block.
+             * @return True iff a bitmap, position array or run container is allocated.
+             */
+            bool hasData() const {
+                return this->data.getData() != NULL || this->hasArray();
             }
 
 
             /**
-             * Test equality of this and other bitblock (other can have different BitBlock type).
-             * @param other Other bitblock.
-             * @return Bitblocks are equal (true) or different (false).
+             * Check whether the block holds its 'ON' bits as a sorted position array instead of a bitmap.
+             * @return True iff the block is a non-empty position array.
              */
-            template <int BS, typename AS, typename BO>
-            bool operator!=(const BitBlock<BS, AS, BO>& other) const {
-                return !(*this == other);
+            bool isArray() const {
+                return !this->array.isRuns() && this->array.getSize() != 0;
             }
 
 
             /**
-             * Check for equality of the specified ranges.
-             * @param myOffset Byte offset of this block.
-             * @param other Other block.
-             * @param otherOffset Byte offset of other block.
-             * @param rangeSize Range size in bytes.
-             * @return Equal (true) or different (false).
+             * Check whether the block holds its 'ON' bits as runs, i.e. pairs of first and last positions.
+             * @return True iff the block is a non-empty run container.
              */
-            template <int BS, typename AS, typename BO>
-            bool equalRange(std::size_t myOffset, const BitBlock<BS, AS, BO>* other, std::size_t otherOffset, std::size_t rangeSize) const {
-                const byte* const myData = this->data.getData() ? this->data.getData() + myOffset : NULL;
-                const byte* const otherData = other && other->data.getData() ? other->data.getData() + otherOffset : NULL;
+            bool isRuns() const {
+                return this->array.isRuns() && this->array.getSize() != 0;
+            }
 
-                if (myData && otherData) {
-                    return 0 == std::memcmp(myData, otherData, rangeSize);
+
+            /**
+             * Write the indexes of the bits with given value to an array.
+             * Note: Decodes a 64 bit word at a time.
+             * @param values Output array.
+             * @param capacity Maximum number of indexes to write.
+             * @param startIndex Bit index to start at.
+             * @param offset Offset to add to the bit indexes.
+             * @param flip Look for 'OFF' (true) instead of 'ON' (false) bits.
+             * @return Number of indexes written.
+             */
+            template <typename T>
+            std::size_t toArray(T* values, const std::size_t capacity, const IndexType startIndex, const IndexType offset, bool flip) const {
+                std::size_t count = 0;
+                if (this->isRuns() && !flip) {
+                    const PositionType* const runs = this->getArrayBegin();
+                    for (std::size_t run = this->findRun(startIndex); run < this->getRunCount() && count < capacity; ++run) {
+                        const IndexType last = runs[2 * run + 1];
+                        for (IndexType index = std::max(startIndex, (IndexType)runs[2 * run]); index <= last && count < capacity; ++index) {
+                            values[count++] = (T)(offset + index);
+                        }
+                    }
+                    return count;
                 }
-                else if (myData) {
-                    return 0 == util::countBits(myData, rangeSize);
+                if (this->isArray() && !flip) {
+                    const PositionType* const end = this->getArrayEnd();
+                    for (const PositionType* it = this->findInArray(startIndex); it != end && count < capacity; ++it) {
+                        values[count++] = (T)(offset + *it);
+                    }
+                    return count;
                 }
-                else if (otherData) {
-                    return 0 == util::countBits(otherData, rangeSize);
+                if (!this->hasData()) {
+                    if (flip) {
+                        for (IndexType index = startIndex; index < ActualBlockLength && count < capacity; ++index) {
+                            values[count++] = (T)(offset + index);
+                        }
+                    }
+                    return count;
                 }
-                else {
-                    return true;
+
+                const unsigned long long flipMask = flip ? ~0ULL : 0;
+                for (IndexType wordIndex = startIndex / 64; wordIndex < WordCount; ++wordIndex) {
+                    unsigned long long w = (this->getWord(wordIndex) ^ flipMask) & getWordMask(wordIndex);
+                    if (wordIndex == startIndex / 64) {
+                        w &= ~0ULL << (startIndex % 64);
+                    }
+                    const IndexType wordOffset = offset + wordIndex * 64;
+                    for (; w; w &= w - 1) {
+                        if (count == capacity) {
+                            return count;
+                        }
+                        values[count++] = (T)(wordOffset + util::countTrailingZeros(w));
+                    }
                 }
+                return count;
             }
 
 
             /**
-             * Serialize the block of data.
-             * @param serializer Serializer.
+             * Hint the processor to load the memory holding a bit into the cache.
+             * @param index Bit index.
              */
-            void serialize(ISerializer& serializer) const {
-                const std::size_t onBitCount = this->count();
-                if (onBitCount == 0) {
-                    serializer.addEmptyBytes(BlockByteCount);
+            void prefetch(IndexType index) const {
+#if defined(__GNUC__)
+                const byte* const block = this->data.getData();
+                if (block) {
+                    __builtin_prefetch(block + index / 8);
                 }
-                else {
-                    serializer.addBytes(this->data.getData(), BlockByteCount, onBitCount);
+                else if (this->hasArray()) {
+                    __builtin_prefetch(this->getArrayBegin());
                 }
+#else
+                (void)index;
+#endif
             }
 
 
             /**
-             * Deserialize the block of data.
-             * @param deserializer Deserializer.
-             * @return Success (true) or failure (false).
+             * Count the number of 'ON' bits in the block.
+             * @param length Include only 'length' bits in the count (default: all bits).
+             * @return Number of 'ON' bits.
              */
-            void deserialize(IDeserializer& deserializer) {
-                static const std::size_t bufferSize = BlockByteCount > 4096 ? 4096 : BlockByteCount;
-                byte buf[bufferSize] = {0}; // Initializes all array elements to 0.
-                std::size_t dataOffset = 0;
-                bool allEmpty = true;
-                byte* data = buf;
-                while (dataOffset < BlockByteCount) {
-                    const std::size_t readSize = bufferSize > BlockByteCount - dataOffset ? BlockByteCount - dataOffset : bufferSize;
-                    bool empty = false;
-                    if (!deserializer.getBytes(data, readSize, empty)) {
-                        break;
-                    }
-                    if (!empty && allEmpty) {
-                        data = this->data.getMutableData();
-                        std::memset(data, 0, BlockByteCount);
-                        data += dataOffset;
-                        std::memcpy(data, buf, readSize);
-                        allEmpty = false;
-                    }
-                    if (!allEmpty) {
-                        data += readSize;
+            IndexType count(const IndexType length = ActualBlockLength) const {
+                if (this->isRuns()) {
+                    return length >= ActualBlockLength ? this->onBitCount : this->countInRuns(0, length);
+                }
+                if (this->isArray()) {
+                    if (length >= ActualBlockLength) {
+                        return this->array.getSize();
                     }
-                    dataOffset += readSize;
+                    return this->findInArray(length) - this->getArrayBegin();
                 }
-
-                if (allEmpty && this->data.getData()) {
-                    this->data = _BitBlockData();
+                const byte* const block = this->data.getData();
+                if (!block) {
+                    return 0;
+                }
+                if (length < ActualBlockLength) {
+                    return util::countBits(block, length);
                 }
+                if (this->onBitCount == UNKNOWN_COUNT) {
+                    this->onBitCount = util::countBits(block, ActualBlockLength);
+                }
+                return this->onBitCount;
             }
 
 
-        private:
-            _BitBlockData data;
-    };
-
-
-    /**
-     * A bit-vector of infinite length with bit-operations.
-     */
-    template < typename _BitBlock = BitBlock<> >
-    class BitVector
-    {
-        template <typename BB> friend class BitVector;
-        typedef _BitBlock _BitBlockType;
-
-        public:
-            enum { BlockSize = _BitBlock::ActualBlockLength };
-            typedef typename _BitBlock::IndexType IndexType;
-            static const IndexType INFINITE = ~((IndexType)0);
-            typedef typename _BitBlock::AllocatorSelector::template BitBlockContainerAllocator<_BitBlock>::type BitBlockContainerAllocator;
-            typedef std::vector< _BitBlock, BitBlockContainerAllocator > BitBlockContainer;
-
             /**
-             * @constructor
+             * Count the number of 'ON' bits in a range of the block.
+             * @param begin First bit-index of the range.
+             * @param end Bit-index after the last bit of the range.
+             * @return Number of 'ON' bits.
              */
-            BitVector() :
-                inverted(false)
-            {
+            IndexType count(const IndexType begin, const IndexType end) const {
+                if (this->isRuns()) {
+                    return this->countInRuns(begin, end);
+                }
+                if (begin == 0 || this->isArray()) {
+                    return begin >= end ? 0 : this->count(end) - this->count(begin);
+                }
+                const byte* const block = this->data.getData();
+                if (!block) {
+                    return 0;
+                }
+                return util::countBitsInRange(block, begin, std::min((IndexType)ActualBlockLength, end));
             }
 
 
             /**
-             * Set the bit at the specified index.
-             * @param index Bit index.
-             * @param value On (true) or off (false).
-             * @return This.
+             * Return the bit-index of the bit with given value and rank, counting from a start index.
+             * @param startIndex Start index.
+             * @param rank Number of bits with the value to skip, starting at startIndex.
+             * @param value Value to look for.
+             * @return Bit-index or ActualBlockLength if not found.
              */
-            BitVector& set(IndexType index, bool value) {
-                const typename BitBlockContainer::size_type blockIndex = index / BlockSize;
-                const bool indexContained = blockIndex < this->blocks.size();
+            IndexType select(const IndexType startIndex, const IndexType rank, bool value) const {
+                if (this->isRuns()) {
+                    const PositionType* const runs = this->getArrayBegin();
+                    IndexType index = startIndex;
+                    IndexType remaining = rank;
+                    for (std::size_t run = this->findRun(startIndex); ; ++run) {
+                        if (value) {
+                            if (run == this->getRunCount()) {
+                                return ActualBlockLength;
+                            }
+                            const IndexType first = std::max(index, (IndexType)runs[2 * run]);
+                            const IndexType length = runs[2 * run + 1] + 1 - first;
+                            if (remaining < length) {
+                                return first + remaining;
+                            }
+                            remaining -= length;
+                            continue;
+                        }
+                        const IndexType gapEnd = run < this->getRunCount() ? (IndexType)runs[2 * run] : (IndexType)ActualBlockLength;
+                        if (index < gapEnd) {
+                            if (remaining < gapEnd - index) {
+                                return index + remaining;
+                            }
+                            remaining -= gapEnd - index;
+                        }
+                        if (run == this->getRunCount()) {
+                            return ActualBlockLength;
+                        }
+                        index = runs[2 * run + 1] + 1;
+                    }
+                }
+                if (this->isArray()) {
+                    const PositionType* const end = this->getArrayEnd();
+                    const PositionType* it = this->findInArray(startIndex);
+                    if (value) {
+                        return rank < (IndexType)(end - it) ? (IndexType)it[rank] : (IndexType)ActualBlockLength;
+                    }
+                    if (rank >= ActualBlockLength - startIndex) {
+                        return ActualBlockLength;
+                    }
+                    IndexType index = startIndex + rank;
+                    for (; it != end && *it <= index; ++it) {
+                        ++index;
+                    }
+                    return index < ActualBlockLength ? index : (IndexType)ActualBlockLength;
+                }
+                const byte* const byteData = this->data.getData();
+                if (!byteData) {
+                    return !value && rank < ActualBlockLength - startIndex ? startIndex + rank : (IndexType)ActualBlockLength;
+                }
+                const std::size_t index = util::selectBitWithValue(byteData, BlockByteCount, startIndex, rank, value);
+                return index == (std::size_t)-1 ? (IndexType)ActualBlockLength : index;
+            }
+
+
+            /**
+             * Perform bitwise AND operation.
+             * @param other Other bit-block.
+             */
+            void bitAnd(const BitBlock& other) {
+                this->apply<operation::AND, false>(other);
+            }
+
+
+            /**
+             * Perform bitwise AND operation with inverted second operand.
+             * @param other Other bit-block.
+             */
+            void bitAndInv(const BitBlock& other) {
+                this->apply<operation::AND_INV, false>(other);
+            }
+
+
+            /**
+             * Perform bitwise AND operation with inverted first operand.
+             * @param other Other bit-block.
+             */
+            void bitInvAnd(const BitBlock& other) {
+                this->apply<operation::INV_AND, false>(other);
+            }
+
+
+            /**
+             * Perform bitwise OR operation.
+             * @param other Other bit-block.
+             */
+            void bitOr(const BitBlock& other) {
+                this->apply<operation::OR, false>(other);
+            }
+
+
+            /**
+             * Perform bitwise XOR operation.
+             * @param other Other bit-block.
+             */
+            void bitXor(const BitBlock& other) {
+                this->apply<operation::XOR, false>(other);
+            }
+
+
+            /**
+             * Perform bitwise AND operation and count the result in the same pass.
+             * @param other Other bit-block.
+             * @return Number of 'ON' bits in the result.
+             */
+            IndexType bitAndCount(const BitBlock& other) {
+                return this->apply<operation::AND, true>(other);
+            }
+
+
+            /**
+             * Perform bitwise OR operation and count the result in the same pass.
+             * @param other Other bit-block.
+             * @return Number of 'ON' bits in the result.
+             */
+            IndexType bitOrCount(const BitBlock& other) {
+                return this->apply<operation::OR, true>(other);
+            }
+
+
+            /**
+             * Perform bitwise XOR operation and count the result in the same pass.
+             * @param other Other bit-block.
+             * @return Number of 'ON' bits in the result.
+             */
+            IndexType bitXorCount(const BitBlock& other) {
+                return this->apply<operation::XOR, true>(other);
+            }
+
+
+            /**
+             * Perform a bitwise operation (see namespace operation), optionally counting the result.
+             * Note: Empty (NULL) blocks are handled without touching any data. Position arrays are
+             *       merged with each other or looked up in the bitmap of the other operand. Runs are
+             *       merged with each other or applied to whole ranges of the other operand's bitmap.
+             *       Operations which may clear bits count the result in the same pass and release
+             *       the data if no 'ON' bits are left.
+             * @param other Other bit-block.
+             * @return Number of 'ON' bits in the result if WithCount is set, otherwise 0.
+             */
+            template <int Operation, bool WithCount>
+            IndexType apply(const BitBlock& other) {
+                const bool hasMyData = this->hasData();
+                const bool hasOtherData = other.hasData();
+                const bool myFull = this->data.isFull();
+                const bool otherFull = other.data.isFull();
+                switch (Operation) {
+                    case operation::AND:
+                        if (!hasMyData || otherFull) {
+                            return WithCount ? this->count() : 0;
+                        }
+                        else if (!hasOtherData) {
+                            this->clearData();
+                            return 0;
+                        }
+                        else if (myFull) {
+                            *this = other;
+                            return WithCount ? this->count() : 0;
+                        }
+                        break;
+
+                    case operation::AND_INV:
+                        if (!hasMyData || !hasOtherData) {
+                            return WithCount ? this->count() : 0;
+                        }
+                        else if (otherFull) {
+                            this->clearData();
+                            return 0;
+                        }
+                        break;
+
+                    case operation::INV_AND:
+                        if (!hasOtherData || myFull) {
+                            this->clearData();
+                            return 0;
+                        }
+                        else if (!hasMyData) {
+                            *this = other;
+                            return WithCount ? this->count() : 0;
+                        }
+                        break;
+
+                    case operation::OR:
+                        if (!hasOtherData || myFull) {
+                            return WithCount ? this->count() : 0;
+                        }
+                        else if (!hasMyData || otherFull) {
+                            *this = other;
+                            return WithCount ? this->count() : 0;
+                        }
+                        break;
+
+                    case operation::XOR:
+                        if (!hasOtherData) {
+                            return WithCount ? this->count() : 0;
+                        }
+                        else if (!hasMyData) {
+                            *this = other;
+                            return WithCount ? this->count() : 0;
+                        }
+                        else if (myFull && otherFull) {
+                            this->clearData();
+                            return 0;
+                        }
+                        break;
+                }
+
+                if (this->isRuns() || other.isRuns()) {
+                    this->applyWithRuns<Operation>(other);
+                    return WithCount ? this->count() : 0;
+                }
+                if (this->isArray() || other.isArray()) {
+                    this->applyWithArray<Operation>(other);
+                    return WithCount ? this->count() : 0;
+                }
+
+                byte* const myMutableData = this->data.getMutableData();
+                if (WithCount || ArrayMaxSize != 0 || Operation != operation::OR) {
+                    // Counting in the same pass is almost free, and tells whether the result is sparse or empty.
+                    this->onBitCount = _BitOpImpl::template executeAndCount<Operation, BlockByteCount>(myMutableData, other.data.getData());
+                    if (this->onBitCount == ActualBlockLength) {
+                        this->data = _BitBlockData::full();
+                    }
+                    else {
+                        this->adaptContainer();
+                    }
+                    return WithCount ? this->onBitCount : 0;
+                }
+                _BitOpImpl::template execute<Operation, BlockByteCount>(myMutableData, other.data.getData());
+                this->onBitCount = UNKNOWN_COUNT;
+                return 0;
+            }
+
+
+            /**
+             * Count the 'ON' bits of the result of a bitwise operation (see namespace operation) without
+             * performing it, so neither block is modified and no memory is allocated.
+             * Note: With a position array or run container operand, only the common 'ON' bits are counted.
+             * @param other Other bit-block.
+             * @return Number of 'ON' bits in the result.
+             */
+            template <int Operation>
+            IndexType countApplied(const BitBlock& other) const {
+                const bool hasMyData = this->hasData();
+                const bool hasOtherData = other.hasData();
+                const bool myFull = this->data.isFull();
+                const bool otherFull = other.data.isFull();
+                switch (Operation) {
+                    case operation::AND:
+                        if (!hasMyData || !hasOtherData) {
+                            return 0;
+                        }
+                        else if (myFull || otherFull) {
+                            return myFull ? other.count() : this->count();
+                        }
+                        break;
+
+                    case operation::AND_INV:
+                        if (!hasMyData || !hasOtherData) {
+                            return this->count();
+                        }
+                        else if (myFull || otherFull) {
+                            return otherFull ? 0 : ActualBlockLength - other.count();
+                        }
+                        break;
+
+                    case operation::INV_AND:
+                        if (!hasMyData || !hasOtherData) {
+                            return other.count();
+                        }
+                        else if (myFull || otherFull) {
+                            return myFull ? 0 : ActualBlockLength - this->count();
+                        }
+                        break;
+
+                    case operation::OR:
+                        if (!hasMyData) {
+                            return other.count();
+                        }
+                        else if (!hasOtherData) {
+                            return this->count();
+                        }
+                        else if (myFull || otherFull) {
+                            return ActualBlockLength;
+                        }
+                        break;
+
+                    case operation::XOR:
+                        if (!hasMyData) {
+                            return other.count();
+                        }
+                        else if (!hasOtherData) {
+                            return this->count();
+                        }
+                        else if (myFull || otherFull) {
+                            return ActualBlockLength - (myFull ? other.count() : this->count());
+                        }
+                        break;
+                }
+
+                if (this->hasArray() || other.hasArray()) {
+                    return resultCount<Operation>(this->count(), other.count(), this->countCommon(other));
+                }
+                return _BitOpImpl::template count<Operation, BlockByteCount>(this->data.getData(), other.data.getData());
+            }
+
+
+            /**
+             * Return the next bit-index where a bit with given value is found.
+             * @param startIndex Start index.
+             * @param value Value to look for.
+             * @return Next bit-index or ActualBlockLength if not found.
+             */
+            IndexType getNext(const IndexType startIndex, bool value) const {
+                if (this->isRuns()) {
+                    const PositionType* const runs = this->getArrayBegin();
+                    const std::size_t run = this->findRun(startIndex);
+                    const bool inRun = run < this->getRunCount() && runs[2 * run] <= startIndex;
+                    if (value) {
+                        return inRun ? startIndex : run < this->getRunCount() ? (IndexType)runs[2 * run] : (IndexType)ActualBlockLength;
+                    }
+                    const IndexType next = inRun ? (IndexType)runs[2 * run + 1] + 1 : startIndex;
+                    return next < ActualBlockLength ? next : (IndexType)ActualBlockLength;
+                }
+                if (this->isArray()) {
+                    const PositionType* const end = this->getArrayEnd();
+                    const PositionType* it = this->findInArray(startIndex);
+                    if (value) {
+                        return it != end ? (IndexType)*it : (IndexType)ActualBlockLength;
+                    }
+                    IndexType index = startIndex;
+                    for (; it != end && *it == index; ++it) {
+                        ++index;
+                    }
+                    return index < ActualBlockLength ? index : (IndexType)ActualBlockLength;
+                }
+                const byte* byteData = this->data.getData();
+                if (!byteData) {
+                    return value ? (IndexType)ActualBlockLength : startIndex;
+                }
+                const std::size_t nextBit = util::getNextBitWithValue(byteData, BlockByteCount, startIndex, value);
+                return nextBit == (std::size_t)-1 ? (IndexType)ActualBlockLength : nextBit;
+            }
+
+
+            /**
+             * Return the previous bit-index (searching downwards) where a bit with given value is found.
+             * @param startIndex Start index (included in the search).
+             * @param value Value to look for.
+             * @return Previous bit-index or ActualBlockLength if not found.
+             */
+            IndexType getPrev(const IndexType startIndex, bool value) const {
+                if (this->isRuns()) {
+                    const PositionType* const runs = this->getArrayBegin();
+                    const std::size_t run = this->findRun(startIndex);
+                    const bool inRun = run < this->getRunCount() && runs[2 * run] <= startIndex;
+                    if (value) {
+                        return inRun ? startIndex : run > 0 ? (IndexType)runs[2 * run - 1] : (IndexType)ActualBlockLength;
+                    }
+                    if (!inRun) {
+                        return startIndex;
+                    }
+                    return runs[2 * run] > 0 ? (IndexType)runs[2 * run] - 1 : (IndexType)ActualBlockLength;
+                }
+                if (this->isArray()) {
+                    const PositionType* const begin = this->getArrayBegin();
+                    const PositionType* it = this->findInArray(startIndex + 1);
+                    if (value) {
+                        return it != begin ? (IndexType)it[-1] : (IndexType)ActualBlockLength;
+                    }
+                    IndexType index = startIndex;
+                    for (; it != begin && it[-1] == index; --it) {
+                        if (index == 0) {
+                            return ActualBlockLength;
+                        }
+                        --index;
+                    }
+                    return index;
+                }
+                const byte* byteData = this->data.getData();
+                if (!byteData) {
+                    return value ? (IndexType)ActualBlockLength : startIndex;
+                }
+                const std::size_t prevBit = util::getPrevBitWithValue(byteData, BlockByteCount, startIndex, value);
+                return prevBit == (std::size_t)-1 ? (IndexType)ActualBlockLength : prevBit;
+            }
+
+
+            /**
+             * Test equality of this and other bitblock (other can have different BitBlock type).
+             * @param other Other bitblock.
+             * @return Bitblocks are equal (true) or different (false).
+             */
+            template <int BS, typename AS, typename BO>
+            bool operator==(const BitBlock<BS, AS, BO>& other) const {
+                if ((int)ActualBlockLength != (int)BitBlock<BS, AS, BO>::ActualBlockLength) {
+                    return false;
+                }
+
+                if (this->isArray()) {
+                    if (this->count() != other.count()) {
+                        return false;
+                    }
+                    for (const PositionType* it = this->getArrayBegin(); it != this->getArrayEnd(); ++it) {
+                        if (!other.get(*it)) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+                else if (this->isRuns()) {
+                    if (this->count() != other.count()) {
+                        return false;
+                    }
+                    const PositionType* const runs = this->getArrayBegin();
+                    for (std::size_t run = 0; run < this->getRunCount(); ++run) {
+                        if (other.count(runs[2 * run], runs[2 * run + 1] + 1) != (IndexType)(runs[2 * run + 1] + 1 - runs[2 * run])) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+                else if (other.hasArray()) {
+                    return other == *this;
+                }
+
+                const byte* myData = this->data.getData();
+                const byte* otherData = other.data.getData();
+
+                if (myData && otherData) {
+                    return 0 == std::memcmp(myData, otherData, BlockByteCount);
+                }
+                else if (myData) {
+                    return this->count() == 0;
+                }
+                else if (otherData) {
+                    return other.count() == 0;
+                }
+
+                return true;
+            }
+
+
+            /**
+             * Test equality of this and other bitblock (other can have different BitBlock type).
+             * @param other Other bitblock.
+             * @return Bitblocks are equal (true) or different (false).
+             */
+            template <int BS, typename AS, typename BO>
+            bool operator!=(const BitBlock<BS, AS, BO>& other) const {
+                return !(*this == other);
+            }
+
+
+            /**
+             * Store the block in the smallest container, e.g. turn a bitmap with few runs of 'ON' bits
+             * into a run container.
+             * Note: Bitwise operations only convert sparse results, as looking for runs takes another
+             *       pass over the bitmap; call this for blocks which are kept for long.
+             */
+            void optimize() {
+                if (ArrayMaxSize != 0) {
+                    this->adaptContainer(true);
+                }
+            }
+
+
+            /**
+             * Hash the content of the block.
+             * Note: Hashes the 64 bit words with 'ON' bits, so equal blocks have equal hashes whatever
+             *       their container (bitmap, position array or run container); blocks without data
+             *       hash to 0.
+             * @return Hash value.
+             */
+            std::size_t hash() const {
+                unsigned long long h = 0;
+                if (this->isArray()) {
+                    const PositionType* it = this->getArrayBegin();
+                    const PositionType* const end = this->getArrayEnd();
+                    while (it != end) {
+                        const IndexType wordIndex = *it / 64;
+                        unsigned long long w = 0;
+                        for (; it != end && *it / 64 == wordIndex; ++it) {
+                            w |= 1ULL << (*it % 64);
+                        }
+                        h = hashWord(h, wordIndex, w);
+                    }
+                }
+                else if (this->isRuns()) {
+                    const PositionType* const runs = this->getArrayBegin();
+                    IndexType wordIndex = this->getRunCount() > 0 ? runs[0] / 64 : (IndexType)WordCount;
+                    while (wordIndex < WordCount) {
+                        h = hashWord(h, wordIndex, this->getWord(wordIndex));
+                        // Continue with the next word, or skip to the word of the next run.
+                        const std::size_t run = this->findRun((wordIndex + 1) * 64);
+                        if (run == this->getRunCount()) {
+                            break;
+                        }
+                        wordIndex = std::max(wordIndex + 1, (IndexType)runs[2 * run] / 64);
+                    }
+                }
+                else {
+                    const byte* const block = this->data.getData();
+                    for (IndexType wordIndex = 0; block && wordIndex < WordCount; ++wordIndex) {
+                        const unsigned long long w = loadWord(block, wordIndex);
+                        if (w) {
+                            h = hashWord(h, wordIndex, w);
+                        }
+                    }
+                }
+                return (std::size_t)(h ^ (h >> 32));
+            }
+
+
+            /**
+             * Check whether this and the other block share their data (or both have none).
+             * @param other Other bit-block.
+             * @return Shared (true) or separate (false).
+             */
+            bool sharesData(const BitBlock& other) const {
+                return this->data.getData() == other.data.getData() && this->array.getPositions() == other.array.getPositions();
+            }
+
+
+            /**
+             * Check for equality of the specified ranges.
+             * @param myOffset Byte offset of this block.
+             * @param other Other block.
+             * @param otherOffset Byte offset of other block.
+             * @param rangeSize Range size in bytes.
+             * @return Equal (true) or different (false).
+             */
+            template <int BS, typename AS, typename BO>
+            bool equalRange(std::size_t myOffset, const BitBlock<BS, AS, BO>* other, std::size_t otherOffset, std::size_t rangeSize) const {
+                if (this->hasArray() || (other && other->hasArray())) {
+                    BitBlock myBitmap(*this);
+                    myBitmap.convertToBitmap();
+                    if (!other) {
+                        return myBitmap.equalRange(myOffset, other, otherOffset, rangeSize);
+                    }
+                    BitBlock<BS, AS, BO> otherBitmap(*other);
+                    otherBitmap.convertToBitmap();
+                    return myBitmap.equalRange(myOffset, &otherBitmap, otherOffset, rangeSize);
+                }
+                const byte* const myData = this->data.getData() ? this->data.getData() + myOffset : NULL;
+                const byte* const otherData = other && other->data.getData() ? other->data.getData() + otherOffset : NULL;
+
+                if (myData && otherData) {
+                    return 0 == std::memcmp(myData, otherData, rangeSize);
+                }
+                else if (myData) {
+                    return 0 == util::countBits(myData, rangeSize);
+                }
+                else if (otherData) {
+                    return 0 == util::countBits(otherData, rangeSize);
+                }
+                else {
+                    return true;
+                }
+            }
+
+
+            /**
+             * Serialize the block of data.
+             * @param serializer Serializer.
+             */
+            void serialize(ISerializer& serializer) const {
+                if (this->isRuns()) {
+                    serializer.addRuns(this->getArrayBegin(), this->getRunCount(), BlockByteCount, this->count());
+                    return;
+                }
+                if (this->isArray()) {
+                    BitBlock bitmap(*this);
+                    bitmap.convertToBitmap();
+                    bitmap.serialize(serializer);
+                    return;
+                }
+                const std::size_t onBitCount = this->count();
+                if (onBitCount == 0) {
+                    serializer.addEmptyBytes(BlockByteCount);
+                }
+                else {
+                    serializer.addBytes(this->data.getData(), BlockByteCount, onBitCount);
+                }
+            }
+
+
+            /**
+             * Deserialize the block of data.
+             * @param deserializer Deserializer.
+             * @return Success (true) or failure (false).
+             */
+            void deserialize(IDeserializer& deserializer) {
+                static const std::size_t bufferSize = BlockByteCount > 4096 ? 4096 : BlockByteCount;
+                byte buf[bufferSize] = {0}; // Initializes all array elements to 0.
+                std::size_t dataOffset = 0;
+                bool allEmpty = true;
+                byte* data = buf;
+                const std::size_t runCount = deserializer.getRunCount(BlockByteCount);
+                if (runCount != (std::size_t)-1 && runCount > 0 && runCount <= RunMaxCount) {
+                    this->clearData();
+                    PositionType* const runs = this->array.getMutablePositions(2 * runCount);
+                    deserializer.getRuns(runs);
+                    this->array.setSize(2 * runCount);
+                    this->array.setRuns(true);
+                    this->onBitCount = countRunBits(runs, runCount);
+                    return;
+                }
+                this->releaseArray();
+                while (dataOffset < BlockByteCount) {
+                    const std::size_t readSize = bufferSize > BlockByteCount - dataOffset ? BlockByteCount - dataOffset : bufferSize;
+                    bool empty = false;
+                    if (!deserializer.getBytes(data, readSize, empty)) {
+                        break;
+                    }
+                    if (!empty && allEmpty) {
+                        data = this->data.getMutableData();
+                        std::memset(data, 0, BlockByteCount);
+                        data += dataOffset;
+                        std::memcpy(data, buf, readSize);
+                        allEmpty = false;
+                    }
+                    if (!allEmpty) {
+                        data += readSize;
+                    }
+                    dataOffset += readSize;
+                }
+
+                if (allEmpty && this->data.getData()) {
+                    this->clearData();
+                }
+                this->onBitCount = allEmpty ? 0 : UNKNOWN_COUNT;
+                if (!allEmpty && ArrayMaxSize != 0) {
+                    this->adaptContainer(true);
+                }
+            }
+
+
+        private:
+            /**
+             * Load a 64 bit word of block data; bits beyond the end of the block are 'OFF'.
+             * @param block Block data.
+             * @param wordIndex Word index, must be less than WordCount.
+             * @return Data word.
+             */
+            static unsigned long long loadWord(const byte* block, const IndexType wordIndex) {
+                if (wordIndex * 8 + 8 <= BlockByteCount) {
+                    return util::loadWord(block + wordIndex * 8);
+                }
+                unsigned long long w = 0;
+                for (IndexType i = wordIndex * 8; i < BlockByteCount; ++i) {
+                    w |= (unsigned long long)block[i] << ((i % 8) * 8);
+                }
+                return w;
+            }
+
+
+            /**
+             * Store a 64 bit word of block data; bits beyond the end of the block are dropped.
+             * @param block Block data.
+             * @param wordIndex Word index, must be less than WordCount.
+             * @param w Data word.
+             */
+            static void storeWord(byte* block, const IndexType wordIndex, unsigned long long w) {
+                if (wordIndex * 8 + 8 <= BlockByteCount) {
+                    util::storeWord(block + wordIndex * 8, w);
+                    return;
+                }
+                for (IndexType i = wordIndex * 8; i < BlockByteCount; ++i, w >>= 8) {
+                    block[i] = (byte)w;
+                }
+            }
+
+
+            /**
+             * Get the 64 bits of block data starting at a bit index; bits beyond the end of the block are 'OFF'.
+             * @param block Block data or NULL for an empty block.
+             * @param bitIndex Bit index.
+             * @return Data word.
+             */
+            static unsigned long long getBits(const byte* block, const IndexType bitIndex) {
+                const IndexType wordIndex = bitIndex / 64;
+                if (!block || wordIndex >= WordCount) {
+                    return 0;
+                }
+                const unsigned long long w = loadWord(block, wordIndex);
+                const unsigned int shift = bitIndex % 64;
+                if (shift == 0) {
+                    return w;
+                }
+                const unsigned long long next = wordIndex + 1 < WordCount ? loadWord(block, wordIndex + 1) : 0;
+                return (w >> shift) | (next << (64 - shift));
+            }
+
+
+            /**
+             * Release the data, making this an empty (NULL) block.
+             */
+            void clearData() {
+                this->data = _BitBlockData();
+                this->releaseArray();
+                this->onBitCount = 0;
+            }
+
+
+            /**
+             * Check whether the block is a position array or run container.
+             * @return True iff the array is not empty.
+             */
+            bool hasArray() const {
+                return this->array.getSize() != 0;
+            }
+
+
+            /**
+             * Release the position array or run container.
+             */
+            void releaseArray() {
+                this->array.clear();
+            }
+
+
+            const PositionType* getArrayBegin() const {
+                return this->array.getPositions();
+            }
+
+
+            const PositionType* getArrayEnd() const {
+                return this->array.getPositions() + this->array.getSize();
+            }
+
+
+            /**
+             * Find the first position of the position array that is not less than a bit index.
+             * @param index Bit index.
+             * @return Pointer to the position or getArrayEnd().
+             */
+            const PositionType* findInArray(const IndexType index) const {
+                return index < ActualBlockLength ? std::lower_bound(this->getArrayBegin(), this->getArrayEnd(), (PositionType)index) : this->getArrayEnd();
+            }
+
+
+            /**
+             * Set the value of a bit of a position array or an empty block.
+             * @param index Bit index.
+             * @param value On (true) or off (false).
+             * @return False iff the array is full and the bit has to be set in a bitmap instead.
+             */
+            bool setInArray(const IndexType index, bool value) {
+                const std::size_t size = this->array.getSize();
+                const PositionType* const it = this->findInArray(index);
+                const std::size_t position = it - this->getArrayBegin();
+                if ((it != this->getArrayEnd() && *it == index) == value) {
+                    return true;
+                }
+                if (value) {
+                    if (size == ArrayMaxSize) {
+                        return false;
+                    }
+                    PositionType* const positions = this->array.getMutablePositions(size + 1);
+                    std::memmove(positions + position + 1, positions + position, (size - position) * sizeof(PositionType));
+                    positions[position] = (PositionType)index;
+                    this->array.setSize(size + 1);
+                }
+                else if (size == 1) {
+                    this->clearData();
+                    return true;
+                }
+                else {
+                    PositionType* const positions = this->array.getMutablePositions(size);
+                    std::memmove(positions + position, positions + position + 1, (size - position - 1) * sizeof(PositionType));
+                    this->array.setSize(size - 1);
+                }
+                this->onBitCount = this->array.getSize();
+                return true;
+            }
+
+
+            /**
+             * Remove the positions within a range from the position array.
+             * @param begin First bit-index of the range.
+             * @param end Bit-index after the last bit of the range.
+             */
+            void eraseFromArray(const IndexType begin, const IndexType end) {
+                const std::size_t size = this->array.getSize();
+                const std::size_t first = this->findInArray(begin) - this->getArrayBegin();
+                const std::size_t last = this->findInArray(end) - this->getArrayBegin();
+                if (first == last) {
+                    return;
+                }
+                if (last - first == size) {
+                    this->clearData();
+                    return;
+                }
+                PositionType* const positions = this->array.getMutablePositions(size);
+                std::memmove(positions + first, positions + last, (size - last) * sizeof(PositionType));
+                this->array.setSize(size - (last - first));
+                this->onBitCount = this->array.getSize();
+            }
+
+
+            /**
+             * Turn a position array or run container into a bitmap (no-op for other blocks).
+             */
+            void convertToBitmap() {
+                if (!this->hasArray()) {
+                    return;
+                }
+                byte* const block = this->data.getMutableData();
+                if (this->array.isRuns()) {
+                    applyRunsToBitmap<operation::OR>(block, this->getArrayBegin(), this->getRunCount());
+                }
+                else {
+                    for (const PositionType* it = this->getArrayBegin(); it != this->getArrayEnd(); ++it) {
+                        block[*it / 8] |= (byte)1 << (*it % 8);
+                    }
+                }
+                this->releaseArray();
+            }
+
+
+            /**
+             * Turn a bitmap with at most ArrayMaxSize / 2 'ON' bits into a position array or with at most
+             * RunMaxCount / 2 runs into a run container, whichever is smaller, or release it if there are
+             * no 'ON' bits (no-op for other blocks).
+             * Note: Converting at half the maximum size avoids flipping back and forth around it. Counting
+             *       the runs takes another pass over the bitmap, so bitmaps with more 'ON' bits than fit the
+             *       array are only checked for runs on request.
+             * @param withRuns Also turn bitmaps with many 'ON' bits but few runs into run containers.
+             */
+            void adaptContainer(bool withRuns = false) {
+                const byte* const block = this->data.getData();
+                if (!block || this->data.isFull()) {
+                    return;
+                }
+                const IndexType count = this->count();
+                if (count == 0) {
+                    this->clearData();
+                    return;
+                }
+                const bool fitsArray = count <= ArrayMaxSize / 2;
+                if (!fitsArray && !withRuns) {
+                    return;
+                }
+                const std::size_t runCount = countRunsInBitmap(block, RunMaxCount / 2);
+                if (runCount <= RunMaxCount / 2 && (!fitsArray || 2 * runCount < count)) {
+                    PositionType* const runs = this->array.getMutablePositions(2 * runCount);
+                    IndexType index = 0;
+                    for (std::size_t run = 0; run < runCount; ++run) {
+                        const std::size_t first = util::getNextBitWithValue(block, BlockByteCount, index, true);
+                        const std::size_t end = util::getNextBitWithValue(block, BlockByteCount, first, false);
+                        index = end == (std::size_t)-1 ? (IndexType)ActualBlockLength : end;
+                        runs[2 * run] = (PositionType)first;
+                        runs[2 * run + 1] = (PositionType)(index - 1);
+                    }
+                    this->array.setSize(2 * runCount);
+                    this->array.setRuns(true);
+                    this->data = _BitBlockData();
+                    return;
+                }
+                if (!fitsArray) {
+                    return;
+                }
+                PositionType* const positions = this->array.getMutablePositions(count);
+                std::size_t size = 0;
+                for (IndexType wordIndex = 0; wordIndex < WordCount; ++wordIndex) {
+                    for (unsigned long long w = loadWord(block, wordIndex); w; w &= w - 1) {
+                        positions[size++] = (PositionType)(wordIndex * 64 + util::countTrailingZeros(w));
+                    }
+                }
+                this->array.setSize(size);
+                this->data = _BitBlockData();
+            }
+
+
+            /**
+             * Perform a bitwise operation where at least one operand is a position array.
+             * Note: Both blocks must have data. Array results are written by merging or filtering
+             *       positions; bitmap results by changing the bits at the positions of the array operand.
+             * @param other Other bit-block.
+             */
+            template <int Operation>
+            void applyWithArray(const BitBlock& other) {
+                if (this->isArray() && other.isArray()) {
+                    const IndexType count = resultCount<Operation>(this->array.getSize(), other.array.getSize(), this->countCommon(other));
+                    if (count == 0) {
+                        this->clearData();
+                        return;
+                    }
+                    if (count <= ArrayMaxSize) {
+                        _BitBlockArray result;
+                        mergeArrays<Operation>(this->getArrayBegin(), this->getArrayEnd(), other.getArrayBegin(), other.getArrayEnd(), result.getMutablePositions(count));
+                        result.setSize(count);
+                        this->array = result;
+                        this->onBitCount = count;
+                        return;
+                    }
+                    this->convertToBitmap();
+                }
+
+                if (this->isArray()) {
+                    if (Operation == operation::AND || Operation == operation::AND_INV) {
+                        this->filterArray(other.data.getData(), Operation == operation::AND);
+                        return;
+                    }
+                    const _BitBlockArray myArray(this->array);
+                    this->releaseArray();
+                    this->data = other.data;
+                    // ~a & b clears the positions of a in b, like b & ~a.
+                    this->onBitCount = applyPositions<Operation == operation::INV_AND ? (int)operation::AND_INV : Operation>(
+                        this->data.getMutableData(), myArray.getPositions(), myArray.getPositions() + myArray.getSize(), other.onBitCount);
+                }
+                else if (Operation == operation::AND || Operation == operation::INV_AND) {
+                    const byte* const block = this->data.getData();
+                    const _BitBlockData myData(this->data);
+                    this->data = _BitBlockData();
+                    this->array = other.array;
+                    this->filterArray(block, Operation == operation::AND);
+                    return;
+                }
+                else {
+                    this->onBitCount = applyPositions<Operation>(this->data.getMutableData(), other.getArrayBegin(), other.getArrayEnd(), this->onBitCount);
+                }
+                if (this->onBitCount <= ArrayMaxSize / 2) {
+                    this->adaptContainer();
+                }
+            }
+
+
+            /**
+             * Keep only the positions of the position array whose bit in a bitmap has a given value.
+             * @param block Bitmap data.
+             * @param value Bit value to keep.
+             */
+            void filterArray(const byte* block, bool value) {
+                const std::size_t size = this->array.getSize();
+                PositionType* const positions = this->array.getMutablePositions(size);
+                std::size_t count = 0;
+                for (std::size_t i = 0; i < size; ++i) {
+                    const PositionType position = positions[i];
+                    if (((block[position / 8] >> (position % 8)) & 1) == (byte)value) {
+                        positions[count++] = position;
+                    }
+                }
+                if (count == 0) {
+                    this->clearData();
+                    return;
+                }
+                this->array.setSize(count);
+                this->onBitCount = count;
+            }
+
+
+            /**
+             * Count the 'ON' bits this block and another block have in common, where at least one of
+             * them is a position array or run container and both have data.
+             * @param other Other bit-block.
+             * @return Number of common 'ON' bits.
+             */
+            IndexType countCommon(const BitBlock& other) const {
+                if (this->isRuns() || other.isRuns()) {
+                    const BitBlock& runBlock = this->isRuns() ? *this : other;
+                    const BitBlock& otherBlock = this->isRuns() ? other : *this;
+                    const PositionType* const runs = runBlock.getArrayBegin();
+                    IndexType count = 0;
+                    if (otherBlock.isRuns()) {
+                        const PositionType* const otherRuns = otherBlock.getArrayBegin();
+                        std::size_t run = 0;
+                        std::size_t otherRun = 0;
+                        while (run < runBlock.getRunCount() && otherRun < otherBlock.getRunCount()) {
+                            const IndexType first = std::max(runs[2 * run], otherRuns[2 * otherRun]);
+                            const IndexType last = std::min(runs[2 * run + 1], otherRuns[2 * otherRun + 1]);
+                            if (first <= last) {
+                                count += last - first + 1;
+                            }
+                            if (runs[2 * run + 1] < otherRuns[2 * otherRun + 1]) {
+                                ++run;
+                            }
+                            else {
+                                ++otherRun;
+                            }
+                        }
+                        return count;
+                    }
+                    for (std::size_t run = 0; run < runBlock.getRunCount(); ++run) {
+                        count += otherBlock.count(runs[2 * run], runs[2 * run + 1] + 1);
+                    }
+                    return count;
+                }
+                if (this->isArray() && other.isArray()) {
+                    const PositionType* it1 = this->getArrayBegin();
+                    const PositionType* it2 = other.getArrayBegin();
+                    IndexType count = 0;
+                    while (it1 != this->getArrayEnd() && it2 != other.getArrayEnd()) {
+                        if (*it1 < *it2) {
+                            ++it1;
+                        }
+                        else if (*it2 < *it1) {
+                            ++it2;
+                        }
+                        else {
+                            ++count;
+                            ++it1;
+                            ++it2;
+                        }
+                    }
+                    return count;
+                }
+                const BitBlock& arrayBlock = this->isArray() ? *this : other;
+                const byte* const block = this->isArray() ? other.data.getData() : this->data.getData();
+                IndexType count = 0;
+                for (const PositionType* it = arrayBlock.getArrayBegin(); it != arrayBlock.getArrayEnd(); ++it) {
+                    count += (block[*it / 8] >> (*it % 8)) & 1;
+                }
+                return count;
+            }
+
+
+            /**
+             * Compute the number of 'ON' bits of the result of a bitwise operation.
+             * @param count1 Number of 'ON' bits of the first operand.
+             * @param count2 Number of 'ON' bits of the second operand.
+             * @param commonCount Number of 'ON' bits the operands have in common.
+             * @return Number of 'ON' bits of the result.
+             */
+            template <int Operation>
+            static IndexType resultCount(const IndexType count1, const IndexType count2, const IndexType commonCount) {
+                switch (Operation) {
+                    case operation::AND: return commonCount;
+                    case operation::AND_INV: return count1 - commonCount;
+                    case operation::INV_AND: return count2 - commonCount;
+                    case operation::OR: return count1 + count2 - commonCount;
+                    default: return count1 + count2 - 2 * commonCount;
+                }
+            }
+
+
+            /**
+             * Merge two position arrays according to a bitwise operation.
+             * @param first1 First position of the first operand.
+             * @param last1 Position after the last position of the first operand.
+             * @param first2 First position of the second operand.
+             * @param last2 Position after the last position of the second operand.
+             * @param out Output positions (with room for the result).
+             */
+            template <int Operation>
+            static void mergeArrays(const PositionType* first1, const PositionType* last1, const PositionType* first2, const PositionType* last2, PositionType* out) {
+                const bool keepCommon = Operation == operation::AND || Operation == operation::OR;
+                const bool keepFirst = Operation == operation::AND_INV || Operation == operation::OR || Operation == operation::XOR;
+                const bool keepSecond = Operation == operation::INV_AND || Operation == operation::OR || Operation == operation::XOR;
+                while (first1 != last1 && first2 != last2) {
+                    if (*first1 < *first2) {
+                        if (keepFirst) {
+                            *out++ = *first1;
+                        }
+                        ++first1;
+                    }
+                    else if (*first2 < *first1) {
+                        if (keepSecond) {
+                            *out++ = *first2;
+                        }
+                        ++first2;
+                    }
+                    else {
+                        if (keepCommon) {
+                            *out++ = *first1;
+                        }
+                        ++first1;
+                        ++first2;
+                    }
+                }
+                if (keepFirst) {
+                    out = std::copy(first1, last1, out);
+                }
+                if (keepSecond) {
+                    std::copy(first2, last2, out);
+                }
+            }
+
+
+            /**
+             * Apply a bitwise operation to a bitmap with a position array as second operand
+             * (AND_INV clears, OR sets and XOR flips the bits at the positions).
+             * @param block Bitmap data.
+             * @param first First position.
+             * @param last Position after the last position.
+             * @param count Number of 'ON' bits of the bitmap or UNKNOWN_COUNT.
+             * @return Number of 'ON' bits of the result or UNKNOWN_COUNT.
+             */
+            template <int Operation>
+            static IndexType applyPositions(byte* block, const PositionType* first, const PositionType* last, IndexType count) {
+                for (; first != last; ++first) {
+                    byte& part = block[*first / 8];
+                    const byte bit = (byte)1 << (*first % 8);
+                    const bool wasSet = (part & bit) != 0;
+                    if (Operation == operation::AND_INV ? wasSet : Operation == operation::OR ? !wasSet : true) {
+                        part ^= bit;
+                        if (count != UNKNOWN_COUNT) {
+                            count += wasSet ? -1 : 1;
+                        }
+                    }
+                }
+                return count;
+            }
+
+
+            /**
+             * Get the number of runs of a run container.
+             */
+            std::size_t getRunCount() const {
+                return this->array.getSize() / 2;
+            }
+
+
+            /**
+             * Find the first run of the run container that does not end before a bit index.
+             * @param index Bit index.
+             * @return Run index or getRunCount() if there is none.
+             */
+            std::size_t findRun(const IndexType index) const {
+                const PositionType* const runs = this->getArrayBegin();
+                std::size_t low = 0;
+                std::size_t high = this->getRunCount();
+                while (low < high) {
+                    const std::size_t middle = low + (high - low) / 2;
+                    if (runs[2 * middle + 1] < index) {
+                        low = middle + 1;
+                    }
+                    else {
+                        high = middle;
+                    }
+                }
+                return low;
+            }
+
+
+            /**
+             * Count the number of 'ON' bits in a range of a run container.
+             * @param begin First bit-index of the range.
+             * @param end Bit-index after the last bit of the range.
+             * @return Number of 'ON' bits.
+             */
+            IndexType countInRuns(const IndexType begin, const IndexType end) const {
+                const PositionType* const runs = this->getArrayBegin();
+                IndexType count = 0;
+                for (std::size_t run = this->findRun(begin); run < this->getRunCount() && runs[2 * run] < end; ++run) {
+                    count += std::min(end, (IndexType)runs[2 * run + 1] + 1) - std::max(begin, (IndexType)runs[2 * run]);
+                }
+                return count;
+            }
+
+
+            /**
+             * Make this a position array of bit indexes, or a run container of their consecutive ranges.
+             * @param first Pointer to the first bit index (in any order, duplicates allowed).
+             * @param last Pointer after the last bit index (at most ArrayMaxSize indexes).
+             * @param offset Offset to subtract from the bit indexes to get the index in the block.
+             * @param asRuns Make a run container if there are at most RunMaxCount runs.
+             */
+            void assignPositions(const IndexType* first, const IndexType* last, const IndexType offset, bool asRuns) {
+                this->clearData();
+                PositionType* const positions = this->array.getMutablePositions(last - first);
+                std::size_t size = 0;
+                bool sorted = true;
+                for (; first != last; ++first, ++size) {
+                    positions[size] = (PositionType)(*first - offset);
+                    sorted = sorted && (size == 0 || positions[size - 1] < positions[size]);
+                }
+                if (!sorted) {
+                    std::sort(positions, positions + size);
+                    size = std::unique(positions, positions + size) - positions;
+                }
+                this->array.setSize(size);
+                this->onBitCount = size;
+                if (!asRuns) {
+                    return;
+                }
+                std::size_t runCount = 1;
+                for (std::size_t i = 1; i < size; ++i) {
+                    runCount += positions[i] != positions[i - 1] + 1;
+                }
+                if (runCount > RunMaxCount) {
+                    return;
+                }
+                _BitBlockArray result;
+                PositionType* const runs = result.getMutablePositions(2 * runCount);
+                std::size_t run = 0;
+                runs[0] = positions[0];
+                for (std::size_t i = 1; i < size; ++i) {
+                    if (positions[i] != positions[i - 1] + 1) {
+                        runs[2 * run + 1] = positions[i - 1];
+                        ++run;
+                        runs[2 * run] = positions[i];
+                    }
+                }
+                runs[2 * run + 1] = positions[size - 1];
+                result.setSize(2 * runCount);
+                result.setRuns(true);
+                this->array = result;
+            }
+
+
+            /**
+             * Make this a run container with a single run.
+             * @param begin First bit-index of the run.
+             * @param end Bit-index after the last bit of the run (greater than begin).
+             */
+            void assignRun(const IndexType begin, const IndexType end) {
+                this->clearData();
+                PositionType* const runs = this->array.getMutablePositions(2);
+                runs[0] = (PositionType)begin;
+                runs[1] = (PositionType)(end - 1);
+                this->array.setSize(2);
+                this->array.setRuns(true);
+                this->onBitCount = end - begin;
+            }
+
+
+            /**
+             * Set the value of a bit of a run container, extending, shrinking, splitting or joining runs.
+             * @param index Bit index.
+             * @param value On (true) or off (false).
+             * @return False iff the run container is full and the bit has to be set in a bitmap instead.
+             */
+            bool setInRuns(const IndexType index, bool value) {
+                const std::size_t size = this->array.getSize();
+                const PositionType* const runs = this->getArrayBegin();
+                const std::size_t run = this->findRun(index);
+                const bool inRun = run < this->getRunCount() && runs[2 * run] <= index;
+                if (inRun == value) {
+                    return true;
+                }
+                const bool touchesPrevious = value && run > 0 && (IndexType)runs[2 * run - 1] + 1 == index;
+                const bool touchesNext = value ? run < this->getRunCount() && (IndexType)runs[2 * run] == index + 1 : (IndexType)runs[2 * run] == index;
+                const bool touchesLast = !value && (IndexType)runs[2 * run + 1] == index;
+                if (!value && touchesNext && touchesLast && size == 2) {
+                    this->clearData();
+                    return true;
+                }
+                const bool insertsRun = !touchesPrevious && !touchesNext && !touchesLast;
+                if (insertsRun && this->getRunCount() == RunMaxCount) {
+                    return false;
+                }
+
+                PositionType* const mutableRuns = this->array.getMutablePositions(insertsRun ? size + 2 : size);
+                if (value ? touchesPrevious && touchesNext : touchesNext && touchesLast) {
+                    // Join two runs, or remove a run of one bit.
+                    const std::size_t removeIndex = value ? 2 * run - 1 : 2 * run;
+                    std::memmove(mutableRuns + removeIndex, mutableRuns + removeIndex + 2, (size - removeIndex - 2) * sizeof(PositionType));
+                    this->array.setSize(size - 2);
+                }
+                else if (touchesPrevious) {
+                    mutableRuns[2 * run - 1] = (PositionType)index;
+                }
+                else if (touchesNext) {
+                    mutableRuns[2 * run] = (PositionType)(value ? index : index + 1);
+                }
+                else if (touchesLast) {
+                    mutableRuns[2 * run + 1] = (PositionType)(index - 1);
+                }
+                else {
+                    // Insert a run of one bit, or split a run around the bit.
+                    std::memmove(mutableRuns + 2 * run + 2, mutableRuns + 2 * run, (size - 2 * run) * sizeof(PositionType));
+                    if (value) {
+                        mutableRuns[2 * run] = (PositionType)index;
+                        mutableRuns[2 * run + 1] = (PositionType)index;
+                    }
+                    else {
+                        mutableRuns[2 * run + 1] = (PositionType)(index - 1);
+                        mutableRuns[2 * run + 2] = (PositionType)(index + 1);
+                    }
+                    this->array.setSize(size + 2);
+                }
+                this->onBitCount += value ? 1 : -1;
+                return true;
+            }
+
+
+            /**
+             * Perform a bitwise operation where at least one operand is a run container.
+             * Note: Both blocks must have data. Two run containers are merged if the result has at most
+             *       RunMaxCount runs; otherwise the runs are applied to whole ranges of a bitmap.
+             * @param other Other bit-block.
+             */
+            template <int Operation>
+            void applyWithRuns(const BitBlock& other) {
+                if (this->isRuns() && other.isRuns()) {
+                    const std::size_t runCount = mergeRuns<Operation>(this->getArrayBegin(), this->getRunCount(), other.getArrayBegin(), other.getRunCount(), NULL);
+                    if (runCount == 0) {
+                        this->clearData();
+                        return;
+                    }
+                    if (runCount <= RunMaxCount) {
+                        _BitBlockArray result;
+                        PositionType* const runs = result.getMutablePositions(2 * runCount);
+                        mergeRuns<Operation>(this->getArrayBegin(), this->getRunCount(), other.getArrayBegin(), other.getRunCount(), runs);
+                        result.setSize(2 * runCount);
+                        result.setRuns(true);
+                        this->array = result;
+                        this->onBitCount = countRunBits(runs, runCount);
+                        return;
+                    }
+                }
+
+                if (other.isRuns()) {
+                    this->convertToBitmap();
+                    applyRunsToBitmap<Operation>(this->data.getMutableData(), other.getArrayBegin(), other.getRunCount());
+                }
+                else if (other.isArray()) {
+                    this->convertToBitmap();
+                    this->applyWithArray<Operation>(other);
+                    return;
+                }
+                else {
+                    const _BitBlockArray myRuns(this->array);
+                    this->releaseArray();
+                    this->data = other.data;
+                    // The runs are the first operand of the operation, so the bitmap takes the mirrored one.
+                    applyRunsToBitmap<Operation == operation::AND_INV ? (int)operation::INV_AND : Operation == operation::INV_AND ? (int)operation::AND_INV : Operation>(
+                        this->data.getMutableData(), myRuns.getPositions(), myRuns.getSize() / 2);
+                }
+                this->onBitCount = UNKNOWN_COUNT;
+                this->adaptContainer();
+            }
+
+
+            /**
+             * Mix a word with 'ON' bits into a hash value (see hash()).
+             * @param h Hash value so far.
+             * @param wordIndex Word index.
+             * @param w Data word (not 0).
+             * @return New hash value.
+             */
+            static unsigned long long hashWord(unsigned long long h, const IndexType wordIndex, const unsigned long long w) {
+                h = (h ^ wordIndex) * 0x100000001B3ULL;
+                h = (h ^ w) * 0x100000001B3ULL;
+                return h ^ (h >> 29);
+            }
+
+
+            /**
+             * Count the 'ON' bits of runs.
+             * @param runs Pairs of first and last bit index of every run.
+             * @param runCount Number of runs.
+             * @return Number of 'ON' bits.
+             */
+            static IndexType countRunBits(const PositionType* runs, const std::size_t runCount) {
+                IndexType count = 0;
+                for (std::size_t run = 0; run < runCount; ++run) {
+                    count += runs[2 * run + 1] + 1 - runs[2 * run];
+                }
+                return count;
+            }
+
+
+            /**
+             * Count the runs of 'ON' bits of a bitmap, up to a limit.
+             * @param block Bitmap data.
+             * @param limit Maximum number of runs to count.
+             * @return Number of runs, or more than limit if there are more.
+             */
+            static std::size_t countRunsInBitmap(const byte* block, const std::size_t limit) {
+                std::size_t runCount = 0;
+                unsigned long long carry = 0;
+                for (IndexType wordIndex = 0; wordIndex < WordCount && runCount <= limit; ++wordIndex) {
+                    const unsigned long long w = loadWord(block, wordIndex);
+                    runCount += util::countBitsInWord(w & ~((w << 1) | carry));
+                    carry = w >> 63;
+                }
+                return runCount;
+            }
+
+
+            /**
+             * Merge two run containers according to a bitwise operation, by sweeping over the run boundaries.
+             * @param runs1 Runs of the first operand.
+             * @param runCount1 Number of runs of the first operand.
+             * @param runs2 Runs of the second operand.
+             * @param runCount2 Number of runs of the second operand.
+             * @param out Output runs, or NULL to only count them.
+             * @return Number of runs of the result.
+             */
+            template <int Operation>
+            static std::size_t mergeRuns(const PositionType* runs1, const std::size_t runCount1, const PositionType* runs2, const std::size_t runCount2, PositionType* out) {
+                const IndexType NO_BOUNDARY = ~((IndexType)0);
+                std::size_t run1 = 0;
+                std::size_t run2 = 0;
+                bool in1 = false;
+                bool in2 = false;
+                bool inResult = false;
+                std::size_t runCount = 0;
+                while (true) {
+                    const IndexType boundary1 = run1 == runCount1 ? NO_BOUNDARY : in1 ? (IndexType)runs1[2 * run1 + 1] + 1 : (IndexType)runs1[2 * run1];
+                    const IndexType boundary2 = run2 == runCount2 ? NO_BOUNDARY : in2 ? (IndexType)runs2[2 * run2 + 1] + 1 : (IndexType)runs2[2 * run2];
+                    const IndexType boundary = std::min(boundary1, boundary2);
+                    if (boundary == NO_BOUNDARY) {
+                        return runCount;
+                    }
+                    if (boundary1 == boundary) {
+                        run1 += in1 ? 1 : 0;
+                        in1 = !in1;
+                    }
+                    if (boundary2 == boundary) {
+                        run2 += in2 ? 1 : 0;
+                        in2 = !in2;
+                    }
+                    const bool value = applyToBits<Operation>(in1, in2);
+                    if (value != inResult) {
+                        if (out) {
+                            out[2 * runCount + (value ? 0 : 1)] = (PositionType)(value ? boundary : boundary - 1);
+                        }
+                        runCount += value ? 0 : 1;
+                        inResult = value;
+                    }
+                }
+            }
+
+
+            /**
+             * Apply a bitwise operation to two bits.
+             */
+            template <int Operation>
+            static bool applyToBits(bool bit1, bool bit2) {
+                switch (Operation) {
+                    case operation::AND: return bit1 && bit2;
+                    case operation::AND_INV: return bit1 && !bit2;
+                    case operation::INV_AND: return !bit1 && bit2;
+                    case operation::OR: return bit1 || bit2;
+                    default: return bit1 != bit2;
+                }
+            }
+
+
+            /**
+             * Apply a bitwise operation to a bitmap with runs as second operand, a whole range at a time.
+             * @param block Bitmap data.
+             * @param runs Pairs of first and last bit index of every run.
+             * @param runCount Number of runs.
+             */
+            template <int Operation>
+            static void applyRunsToBitmap(byte* block, const PositionType* runs, const std::size_t runCount) {
+                const bool clearGaps = Operation == operation::AND || Operation == operation::INV_AND;
+                IndexType gapBegin = 0;
+                for (std::size_t run = 0; run < runCount; ++run) {
+                    const IndexType first = runs[2 * run];
+                    const IndexType end = (IndexType)runs[2 * run + 1] + 1;
+                    if (clearGaps) {
+                        applyToRange<operation::AND_INV>(block, gapBegin, first);
+                    }
+                    if (Operation == operation::AND_INV || Operation == operation::OR) {
+                        applyToRange<Operation>(block, first, end);
+                    }
+                    else if (Operation != operation::AND) {
+                        applyToRange<operation::XOR>(block, first, end);
+                    }
+                    gapBegin = end;
+                }
+                if (clearGaps) {
+                    applyToRange<operation::AND_INV>(block, gapBegin, ActualBlockLength);
+                }
+            }
+
+
+            /**
+             * Clear (AND_INV), set (OR) or flip (XOR) the bits in a range of a bitmap.
+             * @param block Bitmap data.
+             * @param begin First bit-index of the range.
+             * @param end Bit-index after the last bit of the range.
+             */
+            template <int Operation>
+            static void applyToRange(byte* block, IndexType begin, const IndexType end) {
+                while (begin < end) {
+                    const IndexType wordIndex = begin / 64;
+                    const IndexType wordEnd = std::min(end, wordIndex * 64 + 64);
+                    const unsigned long long mask = (~0ULL >> (64 - (wordEnd - begin))) << (begin % 64);
+                    unsigned long long w = loadWord(block, wordIndex);
+                    if (Operation == operation::AND_INV) {
+                        w &= ~mask;
+                    }
+                    else if (Operation == operation::OR) {
+                        w |= mask;
+                    }
+                    else {
+                        w ^= mask;
+                    }
+                    storeWord(block, wordIndex, w);
+                    begin = wordEnd;
+                }
+            }
+
+
+            _BitBlockData data;
+            _BitBlockArray array; // Positions of the 'ON' bits of a position array, or first and last positions of the runs of a run container (then data is NULL).
+            mutable IndexType onBitCount; // Cached number of 'ON' bits or UNKNOWN_COUNT.
+    };
+
+
+    /**
+     * Dense directory of the bit-blocks of a bitvector: a vector with a slot for every block
+     * up to the last one. Lookups are plain indexing; the default for bitvectors whose blocks
+     * are mostly in use.
+     */
+    template < typename _BitBlock >
+    class DenseBlockDirectory
+    {
+        public:
+            typedef typename _BitBlock::AllocatorSelector::template BitBlockContainerAllocator<_BitBlock>::type BitBlockContainerAllocator;
+            typedef std::vector< _BitBlock, BitBlockContainerAllocator > BitBlockContainer;
+            typedef typename BitBlockContainer::size_type size_type;
+            static const size_type NO_BLOCK = ~((size_type)0);
+
+
+            /**
+             * Get the number of blocks, i.e. the index after the last block.
+             * @return Number of blocks.
+             */
+            size_type size() const {
+                return this->blocks.size();
+            }
+
+
+            /**
+             * Check whether there are no blocks.
+             * @return True iff empty.
+             */
+            bool empty() const {
+                return this->blocks.empty();
+            }
+
+
+            /**
+             * Change the number of blocks; new blocks are empty.
+             * @param size Number of blocks.
+             */
+            void resize(size_type size) {
+                this->blocks.resize(size);
+            }
+
+
+            /**
+             * Remove all blocks.
+             */
+            void clear() {
+                this->blocks.clear();
+            }
+
+
+            /**
+             * Swap the blocks with another directory.
+             * @param other Other directory.
+             */
+            void swap(DenseBlockDirectory& other) {
+                this->blocks.swap(other.blocks);
+            }
+
+
+            /**
+             * Get a block (index less than size()).
+             * @param blockIndex Block index.
+             * @return Block.
+             */
+            const _BitBlock& operator[](size_type blockIndex) const {
+                return this->blocks[blockIndex];
+            }
+
+
+            /**
+             * Get a block for modification (index less than size()).
+             * @param blockIndex Block index.
+             * @return Block.
+             */
+            _BitBlock& operator[](size_type blockIndex) {
+                return this->blocks[blockIndex];
+            }
+
+
+            /**
+             * Get a block, or an empty block if the index is beyond the last block.
+             * @param blockIndex Block index.
+             * @return Block.
+             */
+            const _BitBlock& get(size_type blockIndex) const {
+                static const _BitBlock emptyBitBlock;
+                return blockIndex < this->blocks.size() ? this->blocks[blockIndex] : emptyBitBlock;
+            }
+
+
+            /**
+             * Find the first block at or after an index which is stored (and may hold data).
+             * @param blockIndex Block index to start at.
+             * @return Block index or NO_BLOCK if there is none.
+             */
+            size_type nextPresent(size_type blockIndex) const {
+                return blockIndex < this->blocks.size() ? blockIndex : NO_BLOCK;
+            }
+
+
+            /**
+             * Find the last block at or before an index which is stored (and may hold data).
+             * @param blockIndex Block index to start at.
+             * @return Block index or NO_BLOCK if there is none.
+             */
+            size_type prevPresent(size_type blockIndex) const {
+                return blockIndex < this->blocks.size() ? blockIndex : this->blocks.size() - 1;
+            }
+
+
+            /**
+             * Store the blocks stored in the other directory (no-op, all blocks below size() are stored).
+             * @param other Other directory.
+             * @param end Block index after the last block to consider (at most size()).
+             */
+            void addPresent(const DenseBlockDirectory& other, size_type end) {
+                (void)other;
+                (void)end;
+            }
+
+
+            /**
+             * Insert empty blocks at the front, moving all blocks up.
+             * @param count Number of blocks.
+             */
+            void insertFront(size_type count) {
+                this->blocks.insert(this->blocks.begin(), count, _BitBlock());
+            }
+
+
+            /**
+             * Remove blocks from the front, moving the remaining blocks down.
+             * @param count Number of blocks.
+             */
+            void eraseFront(size_type count) {
+                this->blocks.erase(this->blocks.begin(), this->blocks.begin() + std::min(count, this->blocks.size()));
+            }
+
+
+            /**
+             * Drop the trailing blocks without data.
+             * Note: The vector is reallocated when it shrinks below a quarter of its capacity, so the
+             *       memory follows the content of long-lived bitvectors.
+             */
+            void trim() {
+                size_type size = this->blocks.size();
+                while (size > 0 && !this->blocks[size - 1].hasData()) {
+                    --size;
+                }
+                if (size == this->blocks.size()) {
+                    return;
+                }
+                if (size < this->blocks.capacity() / 4) {
+                    BitBlockContainer(this->blocks.begin(), this->blocks.begin() + size).swap(this->blocks);
+                }
+                else {
+                    this->blocks.resize(size);
+                }
+            }
+
+
+            /**
+             * Drop the blocks without data in the index range [begin, end) and the trailing blocks
+             * without data, after blocks in the range were modified.
+             * Note: Blocks before the last block with data keep their slot, so only the trailing blocks
+             *       are dropped (see trim()).
+             * @param begin First block index of the range.
+             * @param end Block index after the last block of the range.
+             */
+            void release(size_type begin, size_type end) {
+                (void)begin;
+                (void)end;
+                this->trim();
+            }
+
+
+        private:
+            BitBlockContainer blocks;
+    };
+
+
+    /**
+     * Sparse directory of the bit-blocks of a bitvector: the indexes of the stored blocks in
+     * increasing order, next to the blocks. Memory is proportional to the number of blocks with
+     * data rather than to the index of the last one, e.g. for bitvectors over 64 bit IDs.
+     * Note: Lookups are binary searches; blocks are appended at the end in constant time and
+     *       inserted elsewhere by moving the blocks after them.
+     */
+    template < typename _BitBlock >
+    class SparseBlockDirectory
+    {
+        public:
+            typedef typename _BitBlock::AllocatorSelector::template BitBlockContainerAllocator<_BitBlock>::type BitBlockContainerAllocator;
+            typedef std::vector< _BitBlock, BitBlockContainerAllocator > BitBlockContainer;
+            typedef typename BitBlockContainer::size_type size_type;
+            typedef typename _BitBlock::AllocatorSelector::template BitBlockContainerAllocator<size_type>::type IndexContainerAllocator;
+            typedef std::vector< size_type, IndexContainerAllocator > IndexContainer;
+            static const size_type NO_BLOCK = ~((size_type)0);
+
+
+            /**
+             * @constructor
+             */
+            SparseBlockDirectory() :
+                blockCount(0)
+            {
+            }
+
+
+            /**
+             * Get the number of blocks, i.e. the index after the last block.
+             * @return Number of blocks.
+             */
+            size_type size() const {
+                return this->blockCount;
+            }
+
+
+            /**
+             * Check whether there are no blocks.
+             * @return True iff empty.
+             */
+            bool empty() const {
+                return this->blockCount == 0;
+            }
+
+
+            /**
+             * Change the number of blocks; new blocks are empty (and not stored).
+             * @param size Number of blocks.
+             */
+            void resize(size_type size) {
+                if (size < this->blockCount) {
+                    const size_type position = this->lowerBound(size);
+                    this->indexes.resize(position);
+                    this->blocks.resize(position);
+                }
+                this->blockCount = size;
+            }
+
+
+            /**
+             * Remove all blocks.
+             */
+            void clear() {
+                this->indexes.clear();
+                this->blocks.clear();
+                this->blockCount = 0;
+            }
+
+
+            /**
+             * Swap the blocks with another directory.
+             * @param other Other directory.
+             */
+            void swap(SparseBlockDirectory& other) {
+                this->indexes.swap(other.indexes);
+                this->blocks.swap(other.blocks);
+                std::swap(this->blockCount, other.blockCount);
+            }
+
+
+            /**
+             * Get a block, or an empty block if it is not stored.
+             * @param blockIndex Block index.
+             * @return Block.
+             */
+            const _BitBlock& operator[](size_type blockIndex) const {
+                return this->get(blockIndex);
+            }
+
+
+            /**
+             * Get a block for modification, storing it if necessary (index less than size()).
+             * @param blockIndex Block index.
+             * @return Block.
+             */
+            _BitBlock& operator[](size_type blockIndex) {
+                if (this->indexes.empty() || this->indexes.back() < blockIndex) {
+                    this->indexes.push_back(blockIndex);
+                    this->blocks.push_back(_BitBlock());
+                    return this->blocks.back();
+                }
+                const size_type position = this->lowerBound(blockIndex);
+                if (this->indexes[position] != blockIndex) {
+                    this->indexes.insert(this->indexes.begin() + position, blockIndex);
+                    this->blocks.insert(this->blocks.begin() + position, _BitBlock());
+                }
+                return this->blocks[position];
+            }
+
+
+            /**
+             * Get a block, or an empty block if it is not stored.
+             * @param blockIndex Block index.
+             * @return Block.
+             */
+            const _BitBlock& get(size_type blockIndex) const {
+                static const _BitBlock emptyBitBlock;
+                const size_type position = this->lowerBound(blockIndex);
+                return position < this->indexes.size() && this->indexes[position] == blockIndex ? this->blocks[position] : emptyBitBlock;
+            }
+
+
+            /**
+             * Find the first block at or after an index which is stored (and may hold data).
+             * @param blockIndex Block index to start at.
+             * @return Block index or NO_BLOCK if there is none.
+             */
+            size_type nextPresent(size_type blockIndex) const {
+                const size_type position = this->lowerBound(blockIndex);
+                return position < this->indexes.size() ? this->indexes[position] : NO_BLOCK;
+            }
+
+
+            /**
+             * Find the last block at or before an index which is stored (and may hold data).
+             * @param blockIndex Block index to start at.
+             * @return Block index or NO_BLOCK if there is none.
+             */
+            size_type prevPresent(size_type blockIndex) const {
+                const size_type position = std::upper_bound(this->indexes.begin(), this->indexes.end(), blockIndex) - this->indexes.begin();
+                return position > 0 ? this->indexes[position - 1] : NO_BLOCK;
+            }
+
+
+            /**
+             * Store (empty) blocks at the indexes of the blocks stored in the other directory, so that
+             * an operation can update the blocks in place.
+             * Note: Merges the indexes in one pass.
+             * @param other Other directory.
+             * @param end Block index after the last block to consider (at most size()).
+             */
+            void addPresent(const SparseBlockDirectory& other, size_type end) {
+                const size_type otherEnd = other.lowerBound(end);
+                size_type missingCount = 0;
+                for (size_type position = 0, otherPosition = 0; otherPosition < otherEnd; ++otherPosition) {
+                    while (position < this->indexes.size() && this->indexes[position] < other.indexes[otherPosition]) {
+                        ++position;
+                    }
+                    if (position == this->indexes.size() || this->indexes[position] != other.indexes[otherPosition]) {
+                        ++missingCount;
+                    }
+                }
+                if (missingCount == 0) {
+                    return;
+                }
+
+                IndexContainer mergedIndexes;
+                BitBlockContainer mergedBlocks;
+                mergedIndexes.reserve(this->indexes.size() + missingCount);
+                mergedBlocks.reserve(this->indexes.size() + missingCount);
+                size_type position = 0;
+                for (size_type otherPosition = 0; otherPosition < otherEnd; ++otherPosition) {
+                    const size_type blockIndex = other.indexes[otherPosition];
+                    for (; position < this->indexes.size() && this->indexes[position] <= blockIndex; ++position) {
+                        mergedIndexes.push_back(this->indexes[position]);
+                        mergedBlocks.push_back(this->blocks[position]);
+                    }
+                    if (mergedIndexes.empty() || mergedIndexes.back() != blockIndex) {
+                        mergedIndexes.push_back(blockIndex);
+                        mergedBlocks.push_back(_BitBlock());
+                    }
+                }
+                mergedIndexes.insert(mergedIndexes.end(), this->indexes.begin() + position, this->indexes.end());
+                mergedBlocks.insert(mergedBlocks.end(), this->blocks.begin() + position, this->blocks.end());
+                this->indexes.swap(mergedIndexes);
+                this->blocks.swap(mergedBlocks);
+            }
+
+
+            /**
+             * Insert empty blocks at the front, moving all blocks up.
+             * @param count Number of blocks.
+             */
+            void insertFront(size_type count) {
+                for (typename IndexContainer::iterator it = this->indexes.begin(); it != this->indexes.end(); ++it) {
+                    *it += count;
+                }
+                this->blockCount += count;
+            }
+
+
+            /**
+             * Remove blocks from the front, moving the remaining blocks down.
+             * @param count Number of blocks.
+             */
+            void eraseFront(size_type count) {
+                const size_type position = this->lowerBound(count);
+                this->indexes.erase(this->indexes.begin(), this->indexes.begin() + position);
+                this->blocks.erase(this->blocks.begin(), this->blocks.begin() + position);
+                for (typename IndexContainer::iterator it = this->indexes.begin(); it != this->indexes.end(); ++it) {
+                    *it -= count;
+                }
+                this->blockCount = count < this->blockCount ? this->blockCount - count : 0;
+            }
+
+
+            /**
+             * Drop the trailing blocks without data; the size ends after the last remaining block.
+             * Note: Checks from the back, so the cost is proportional to the number of dropped blocks.
+             *       The vectors are reallocated when they shrink below a quarter of their capacity.
+             */
+            void trim() {
+                size_type size = this->indexes.size();
+                while (size > 0 && !this->blocks[size - 1].hasData()) {
+                    --size;
+                }
+                this->blockCount = size > 0 ? this->indexes[size - 1] + 1 : 0;
+                if (size == this->indexes.size()) {
+                    return;
+                }
+                if (size < this->blocks.capacity() / 4) {
+                    IndexContainer(this->indexes.begin(), this->indexes.begin() + size).swap(this->indexes);
+                    BitBlockContainer(this->blocks.begin(), this->blocks.begin() + size).swap(this->blocks);
+                }
+                else {
+                    this->indexes.resize(size);
+                    this->blocks.resize(size);
+                }
+            }
+
+
+            /**
+             * Drop the blocks without data in the index range [begin, end) and the trailing blocks
+             * without data, after blocks in the range were modified.
+             * Note: Only visits the stored blocks in the range, and moves the blocks after it once.
+             * @param begin First block index of the range.
+             * @param end Block index after the last block of the range.
+             */
+            void release(size_type begin, size_type end) {
+                const size_type first = this->lowerBound(begin);
+                const size_type last = this->lowerBound(end);
+                size_type kept = first;
+                for (size_type position = first; position < last; ++position) {
+                    if (this->blocks[position].hasData()) {
+                        if (kept != position) {
+                            this->indexes[kept] = this->indexes[position];
+                            this->blocks[kept] = this->blocks[position];
+                        }
+                        ++kept;
+                    }
+                }
+                if (kept != last) {
+                    this->indexes.erase(this->indexes.begin() + kept, this->indexes.begin() + last);
+                    this->blocks.erase(this->blocks.begin() + kept, this->blocks.begin() + last);
+                }
+                this->trim();
+            }
+
+
+        private:
+            /**
+             * Find the position of the first stored block at or after an index.
+             * @param blockIndex Block index.
+             * @return Position in the vectors.
+             */
+            size_type lowerBound(size_type blockIndex) const {
+                return std::lower_bound(this->indexes.begin(), this->indexes.end(), blockIndex) - this->indexes.begin();
+            }
+
+
+            IndexContainer indexes; // Indexes of the stored blocks, in increasing order.
+            BitBlockContainer blocks;
+            size_type blockCount; // Index after the last block (stored or not).
+    };
+
+
+    /**
+     * Rank directory of a sequence of bit-blocks.
+     * Holds the cumulative 'ON' bit count before every stored block and, for non-empty blocks,
+     * the count before every superword of SuperwordLength bits within the block.
+     * Note: With a dense block directory the entry of a block is found by its index, otherwise
+     *       by binary search; blocks which are not stored have no entry.
+     */
+    template < typename _BitBlock >
+    class RankDirectory
+    {
+        public:
+            typedef typename _BitBlock::IndexType IndexType;
+            typedef unsigned int SubCountType;
+            enum {
+                BlockSize = _BitBlock::ActualBlockLength,
+                SuperwordLength = 512,
+                SuperwordsPerBlock = 1 + ((BlockSize - 1) / SuperwordLength),
+            };
+            static const IndexType NO_SUB_COUNTS = ~((IndexType)0);
+
+
+            /**
+             * @constructor
+             */
+            RankDirectory() :
+                valid(false)
+            {
+            }
+
+
+            /**
+             * Check whether the directory matches the blocks it was built from.
+             * @return True iff valid.
+             */
+            bool isValid() const {
+                return this->valid;
+            }
+
+
+            /**
+             * Mark the directory outdated, e.g. after the blocks were modified.
+             * Note: Keeps the memory for a later rebuild.
+             */
+            void invalidate() {
+                this->valid = false;
+            }
+
+
+            /**
+             * Invalidate the directory and release its memory.
+             */
+            void release() {
+                this->valid = false;
+                BlockEntryContainer().swap(this->blockEntries);
+                SubCountContainer().swap(this->subCounts);
+            }
+
+
+            /**
+             * Build the directory.
+             * @param blocks Container of bit-blocks.
+             */
+            template <typename BitBlockContainer>
+            void build(const BitBlockContainer& blocks) {
+                this->blockEntries.clear();
+                this->subCounts.clear();
+
+                IndexType count = 0;
+                for (std::size_t blockIndex = blocks.nextPresent(0); blockIndex < blocks.size(); blockIndex = blocks.nextPresent(blockIndex + 1)) {
+                    const _BitBlock& block = blocks[blockIndex];
+                    this->blockEntries.push_back(BlockEntry());
+                    BlockEntry& entry = this->blockEntries.back();
+                    entry.blockIndex = blockIndex;
+                    entry.count = count;
+                    entry.subCountOffset = NO_SUB_COUNTS;
+
+                    const IndexType blockCount = block.count();
+                    if (blockCount > 0) {
+                        entry.subCountOffset = this->subCounts.size();
+                        SubCountType subCount = 0;
+                        for (IndexType offset = 0; offset < BlockSize; offset += SuperwordLength) {
+                            this->subCounts.push_back(subCount);
+                            subCount += block.count(offset, offset + SuperwordLength);
+                        }
+                    }
+                    count += blockCount;
+                }
+
+                this->blockEntries.push_back(BlockEntry());
+                BlockEntry& totalEntry = this->blockEntries.back();
+                totalEntry.blockIndex = blocks.size();
+                totalEntry.count = count;
+                totalEntry.subCountOffset = NO_SUB_COUNTS;
+                this->valid = true;
+            }
+
+
+            /**
+             * Count the number of 'ON' bits before an index.
+             * Note: The directory should be valid for the blocks.
+             * @param blocks Container of bit-blocks the directory was built from.
+             * @param index Bit index.
+             * @return Number of 'ON' bits in the range [0, index).
+             */
+            template <typename BitBlockContainer>
+            IndexType rank(const BitBlockContainer& blocks, IndexType index) const {
+                const std::size_t blockIndex = index / BlockSize;
+                if (blockIndex >= blocks.size()) {
+                    return this->blockEntries.back().count;
+                }
+                const BlockEntry& entry = this->findEntry(blockIndex);
+                if (entry.blockIndex != blockIndex || entry.subCountOffset == NO_SUB_COUNTS) {
+                    return entry.count;
+                }
+                const IndexType blockOffset = index % BlockSize;
+                const IndexType superwordIndex = blockOffset / SuperwordLength;
+                const IndexType superwordOffset = superwordIndex * SuperwordLength;
+                return entry.count + this->subCounts[entry.subCountOffset + superwordIndex] + blocks[blockIndex].count(superwordOffset, blockOffset);
+            }
+
+
+            /**
+             * Find the bit with given value and rank.
+             * Note: The directory should be valid for the blocks. Binary searches the block counts
+             *       and the superword counts, then selects within at most one superword.
+             * @param blocks Container of bit-blocks the directory was built from.
+             * @param rank Rank of the bit (counting from 0).
+             * @param value Value to look for; bits beyond the last block are 'OFF'.
+             * @return Bit index or INFINITE if not found.
+             */
+            template <typename BitBlockContainer>
+            IndexType select(const BitBlockContainer& blocks, IndexType rank, bool value) const {
+                std::size_t low = 0;
+                std::size_t high = this->blockEntries.size() - 1;
+                while (low < high) {
+                    const std::size_t middle = high - (high - low) / 2;
+                    if (this->countBeforeEntry(middle, value) <= rank) {
+                        low = middle;
+                    }
+                    else {
+                        high = middle - 1;
+                    }
+                }
+                const IndexType countBefore = this->countBeforeEntry(low, value);
+                if (rank < countBefore) {
+                    // In the gap of blocks which are not stored, before the first stored block
+                    // (only 'OFF' bits; the gaps after stored blocks are handled below).
+                    return rank;
+                }
+                const BlockEntry& entry = this->blockEntries[low];
+                const IndexType blockStart = entry.blockIndex * BlockSize;
+                rank -= countBefore;
+                if (low + 1 == this->blockEntries.size()) {
+                    return value ? ~((IndexType)0) : blockStart + rank;
+                }
+                if (entry.subCountOffset == NO_SUB_COUNTS) {
+                    return blockStart + rank;
+                }
+                const IndexType blockCount = this->blockEntries[low + 1].count - entry.count;
+                if (!value && rank >= BlockSize - blockCount) {
+                    // In the gap of blocks which are not stored, after this block.
+                    return blockStart + blockCount + rank;
+                }
+                const SubCountType* const blockSubCounts = &this->subCounts[entry.subCountOffset];
+                low = 0;
+                high = SuperwordsPerBlock - 1;
+                while (low < high) {
+                    const std::size_t middle = high - (high - low) / 2;
+                    const IndexType countBefore = value ? blockSubCounts[middle] : middle * SuperwordLength - blockSubCounts[middle];
+                    if (countBefore <= rank) {
+                        low = middle;
+                    }
+                    else {
+                        high = middle - 1;
+                    }
+                }
+                rank -= value ? blockSubCounts[low] : low * SuperwordLength - blockSubCounts[low];
+                return blockStart + blocks[entry.blockIndex].select(low * SuperwordLength, rank, value);
+            }
+
+
+        private:
+            struct BlockEntry {
+                std::size_t blockIndex; // Index of the block (the number of blocks for the total entry).
+                IndexType count; // Number of 'ON' bits before the block.
+                IndexType subCountOffset; // Offset of the block's sub-counts or NO_SUB_COUNTS if the block is empty.
+            };
+            typedef typename _BitBlock::AllocatorSelector::template BitBlockContainerAllocator<BlockEntry>::type BlockEntryAllocator;
+            typedef std::vector<BlockEntry, BlockEntryAllocator> BlockEntryContainer;
+            typedef typename _BitBlock::AllocatorSelector::template BitBlockContainerAllocator<SubCountType>::type SubCountAllocator;
+            typedef std::vector<SubCountType, SubCountAllocator> SubCountContainer;
+
+
+            /**
+             * Find the entry of a block, or of the first stored block after it.
+             * @param blockIndex Block index (less than the number of blocks).
+             * @return Block entry.
+             */
+            const BlockEntry& findEntry(std::size_t blockIndex) const {
+                if (blockIndex < this->blockEntries.size() && this->blockEntries[blockIndex].blockIndex == blockIndex) {
+                    return this->blockEntries[blockIndex];
+                }
+                std::size_t low = 0;
+                std::size_t high = this->blockEntries.size() - 1;
+                while (low < high) {
+                    const std::size_t middle = low + (high - low) / 2;
+                    if (this->blockEntries[middle].blockIndex < blockIndex) {
+                        low = middle + 1;
+                    }
+                    else {
+                        high = middle;
+                    }
+                }
+                return this->blockEntries[low];
+            }
+
+
+            /**
+             * Count the number of bits with given value before the block of an entry.
+             * @param entryIndex Entry index (up to the number of stored blocks).
+             * @param value Value to count.
+             * @return Number of bits.
+             */
+            IndexType countBeforeEntry(std::size_t entryIndex, bool value) const {
+                const BlockEntry& entry = this->blockEntries[entryIndex];
+                return value ? entry.count : entry.blockIndex * BlockSize - entry.count;
+            }
+
+
+            bool valid;
+            BlockEntryContainer blockEntries;
+            SubCountContainer subCounts;
+    };
+
+
+    /**
+     * A bit-vector of infinite length with bit-operations.
+     * Note: The blocks are held in a DenseBlockDirectory by default; a SparseBlockDirectory
+     *       only stores the blocks in use, for bitvectors whose 'ON' bits are far apart.
+     */
+    template < typename _BitBlock = BitBlock<>, typename _BlockDirectory = DenseBlockDirectory<_BitBlock> >
+    class BitVector
+    {
+        template <typename BB, typename BD> friend class BitVector;
+        typedef _BitBlock _BitBlockType;
+
+        public:
+            enum { BlockSize = _BitBlock::ActualBlockLength };
+            typedef typename _BitBlock::IndexType IndexType;
+            static const IndexType INFINITE = ~((IndexType)0);
+            typedef _BlockDirectory BitBlockContainer;
+
+
+            /**
+             * Forward iterator over the indexes of the 'ON' bits, in increasing order.
+             * Note: Keeps a cursor on the current 64 bit word, so stepping costs a few
+             *       instructions per 'ON' bit. Any modification of the bitvector invalidates it.
+             */
+            class ConstIterator
+            {
+                friend class BitVector;
+
+                public:
+                    typedef std::forward_iterator_tag iterator_category;
+                    typedef IndexType value_type;
+                    typedef std::ptrdiff_t difference_type;
+                    typedef const IndexType* pointer;
+                    typedef const IndexType& reference;
+
+
+                    /**
+                     * @constructor End iterator.
+                     */
+                    ConstIterator() :
+                        blocks(NULL),
+                        block(NULL),
+                        flipMask(0),
+                        endIndex(INFINITE),
+                        blockIndex(0),
+                        wordIndex(0),
+                        word(0),
+                        position(INFINITE)
+                    {
+                    }
+
+
+                    /**
+                     * Get the index of the current 'ON' bit.
+                     */
+                    reference operator*() const {
+                        return this->position;
+                    }
+
+
+                    pointer operator->() const {
+                        return &this->position;
+                    }
+
+
+                    /**
+                     * Advance to the next 'ON' bit.
+                     */
+                    ConstIterator& operator++() {
+                        this->word &= this->word - 1;
+                        this->findNext();
+                        return *this;
+                    }
+
+
+                    ConstIterator operator++(int) {
+                        ConstIterator it(*this);
+                        ++*this;
+                        return it;
+                    }
+
+
+                    /**
+                     * Compare iterators by position; all end iterators are equal.
+                     */
+                    bool operator==(const ConstIterator& other) const {
+                        return this->position == other.position;
+                    }
+
+
+                    bool operator!=(const ConstIterator& other) const {
+                        return this->position != other.position;
+                    }
+
+
+                private:
+                    /**
+                     * @constructor
+                     * @param blocks Blocks of the bitvector.
+                     * @param inverted Inverted flag of the bitvector.
+                     * @param startIndex First bit index to consider.
+                     * @param endIndex Bit index where iteration ends.
+                     */
+                    ConstIterator(const BitBlockContainer* blocks, bool inverted, IndexType startIndex, IndexType endIndex) :
+                        blocks(blocks),
+                        block(NULL),
+                        flipMask(inverted ? ~0ULL : 0),
+                        endIndex(endIndex),
+                        blockIndex(startIndex / BlockSize),
+                        wordIndex((startIndex % BlockSize) / 64),
+                        word(0),
+                        position(INFINITE)
+                    {
+                        if (startIndex >= endIndex || (!inverted && this->blockIndex >= blocks->size())) {
+                            return;
+                        }
+                        this->block = &blocks->get(this->blockIndex);
+                        this->word = this->loadWord() & (~0ULL << (startIndex % 64));
+                        this->findNext();
+                    }
+
+
+                    unsigned long long loadWord() const {
+                        return (this->block->getWord(this->wordIndex) ^ this->flipMask) & _BitBlock::getWordMask(this->wordIndex);
+                    }
+
+
+                    void findNext() {
+                        while (!this->word) {
+                            if (!this->flipMask && this->wordIndex + 1 < _BitBlock::WordCount) {
+                                // Jump to the word holding the next 'ON' bit of the block.
+                                const IndexType next = this->block->getNext((this->wordIndex + 1) * 64, true);
+                                this->wordIndex = (next < BlockSize ? next / 64 : (IndexType)_BitBlock::WordCount) - 1;
+                            }
+                            if (++this->wordIndex == _BitBlock::WordCount) {
+                                this->wordIndex = 0;
+                                ++this->blockIndex;
+                                if (!this->flipMask) {
+                                    // Skip the blocks without data.
+                                    this->blockIndex = this->blocks->nextPresent(this->blockIndex);
+                                    while (this->blockIndex < this->blocks->size() && !(*this->blocks)[this->blockIndex].hasData()) {
+                                        this->blockIndex = this->blocks->nextPresent(this->blockIndex + 1);
+                                    }
+                                }
+                                this->block = &this->blocks->get(this->blockIndex);
+                            }
+                            const IndexType wordStart = this->blockIndex * BlockSize + this->wordIndex * 64;
+                            if (wordStart >= this->endIndex || (!this->flipMask && this->blockIndex >= this->blocks->size())) {
+                                this->position = INFINITE;
+                                return;
+                            }
+                            this->word = this->loadWord();
+                        }
+                        this->position = this->blockIndex * BlockSize + this->wordIndex * 64 + util::countTrailingZeros(this->word);
+                        if (this->position >= this->endIndex) {
+                            this->position = INFINITE;
+                        }
+                    }
+
+
+                    const BitBlockContainer* blocks;
+                    const _BitBlock* block; // Block at blockIndex (an empty block beyond the last one).
+                    unsigned long long flipMask;
+                    IndexType endIndex;
+                    typename BitBlockContainer::size_type blockIndex;
+                    IndexType wordIndex;
+                    unsigned long long word; // Remaining 'ON' bits of the current word.
+                    IndexType position;
+            };
+            typedef ConstIterator const_iterator;
+
+
+            /**
+             * Range of 'ON' bit indexes, for use in range-based for loops.
+             */
+            class ConstRange
+            {
+                public:
+                    /**
+                     * @constructor
+                     */
+                    ConstRange(const const_iterator& first, const const_iterator& last) :
+                        first(first),
+                        last(last)
+                    {
+                    }
+
+
+                    const_iterator begin() const {
+                        return this->first;
+                    }
+
+
+                    const_iterator end() const {
+                        return this->last;
+                    }
+
+
+                private:
+                    const_iterator first;
+                    const_iterator last;
+            };
+
+
+            /**
+             * @constructor
+             */
+            BitVector() :
+                inverted(false)
+            {
+            }
+
+
+            /**
+             * Set the bit at the specified index.
+             * @param index Bit index.
+             * @param value On (true) or off (false).
+             * @return This.
+             */
+            BitVector& set(IndexType index, bool value) {
+                const typename BitBlockContainer::size_type blockIndex = index / BlockSize;
+                const bool indexContained = blockIndex < this->blocks.size();
+                if (!indexContained) {
+                    if (value == this->inverted) {
+                        return *this;
+                    }
+                    this->blocks.resize(blockIndex + 1);
+                }
+                else if (value == this->inverted && !this->blocks.get(blockIndex).hasData()) {
+                    return *this;
+                }
+                this->blocks[blockIndex].set(index % BlockSize, this->inverted ? !value : value);
+                this->rankDirectory.invalidate();
+                if (!this->blocks.get(blockIndex).hasData()) {
+                    this->blocks.release(blockIndex, blockIndex + 1);
+                }
+                return *this;
+            }
+
+
+            /**
+             * Set multiple bits to the same value.
+             * Note: Resizes the blocks only once and groups the indexes by block; most effective
+             *       for sorted indexes, but any order (and duplicates) is allowed.
+             * @param first Pointer to the first bit index.
+             * @param last Pointer after the last bit index.
+             * @param value On (true) or off (false).
+             * @return This.
+             */
+            BitVector& setMany(const IndexType* first, const IndexType* last, bool value) {
+                if (first == last) {
+                    return *this;
+                }
+                const bool blockValue = this->inverted ? !value : value;
+                if (blockValue) {
+                    const IndexType maxIndex = *std::max_element(first, last);
+                    if (maxIndex / BlockSize >= this->blocks.size()) {
+                        this->blocks.resize(maxIndex / BlockSize + 1);
+                    }
+                }
+                this->rankDirectory.invalidate();
+
+                // Range of the cleared blocks, to release the ones left without data.
+                typename BitBlockContainer::size_type releaseBegin = this->blocks.size();
+                typename BitBlockContainer::size_type releaseEnd = 0;
+                while (first != last) {
+                    const typename BitBlockContainer::size_type blockIndex = *first / BlockSize;
+                    const IndexType blockStart = blockIndex * BlockSize;
+                    const IndexType* blockLast = first + 1;
+                    while (blockLast != last && *blockLast - blockStart < BlockSize) {
+                        ++blockLast;
+                    }
+                    if (blockIndex < this->blocks.size() && (blockValue || this->blocks.get(blockIndex).hasData())) {
+                        this->blocks[blockIndex].setMany(first, blockLast, blockStart, blockValue);
+                        releaseBegin = std::min(releaseBegin, blockIndex);
+                        releaseEnd = std::max(releaseEnd, blockIndex + 1);
+                    }
+                    first = blockLast;
+                }
+                if (!blockValue && releaseBegin < releaseEnd) {
+                    this->blocks.release(releaseBegin, releaseEnd);
+                }
+                return *this;
+            }
+
+
+            /**
+             * Set all bits in the index range [begin, end) to the same value.
+             * Note: Partial blocks are written a byte range at a time and fully covered blocks
+             *       in constant time (see BitBlock::setRange).
+             * @param begin First bit index of the range.
+             * @param end Bit index after the last bit of the range.
+             * @param value On (true) or off (false).
+             * @return This.
+             */
+            BitVector& setRange(IndexType begin, IndexType end, bool value) {
+                const bool blockValue = this->inverted ? !value : value;
+                if (!blockValue && end > this->blocks.size() * BlockSize) {
+                    end = this->blocks.size() * BlockSize;
+                }
+                if (begin >= end) {
+                    return *this;
+                }
+                const typename BitBlockContainer::size_type lastBlockIndex = (end - 1) / BlockSize;
+                if (lastBlockIndex >= this->blocks.size()) {
+                    this->blocks.resize(lastBlockIndex + 1);
+                }
+                this->rankDirectory.invalidate();
+
+                // Clearing only visits the stored blocks.
+                typename BitBlockContainer::size_type blockIndex = blockValue ? begin / BlockSize : this->blocks.nextPresent(begin / BlockSize);
+                for (; blockIndex <= lastBlockIndex; blockIndex = blockValue ? blockIndex + 1 : this->blocks.nextPresent(blockIndex + 1)) {
+                    const IndexType blockStart = blockIndex * BlockSize;
+                    const IndexType blockBegin = begin > blockStart ? begin - blockStart : 0;
+                    const IndexType blockEnd = end - blockStart < BlockSize ? end - blockStart : (IndexType)BlockSize;
+                    this->blocks[blockIndex].setRange(blockBegin, blockEnd, blockValue);
+                }
+                if (!blockValue) {
+                    this->blocks.release(begin / BlockSize, lastBlockIndex + 1);
+                }
+                return *this;
+            }
+
+
+            /**
+             * Get the bit value at the specified index.
+             * @param index Bit index.
+             * @return On (true) or off (false).
+             */
+            bool get(IndexType index) const {
+                const typename BitBlockContainer::size_type blockIndex = index / BlockSize;
+                const bool indexContained = blockIndex < this->blocks.size();
                 if (!indexContained) {
-                    if (value == this->inverted) {
-                        return *this;
+                    return this->inverted;
+                }
+                const bool value = this->blocks[blockIndex].get(index % BlockSize);
+                return this->inverted ? !value : value;
+            }
+
+
+            /**
+             * Get the values of multiple bits into a bool array.
+             * Note: Probes falling into the same block are handled together; for unsorted probes
+             *       the memory of upcoming probes is prefetched.
+             * @param indexes Bit indexes (any order).
+             * @param count Number of bit indexes.
+             * @param values Output array of 'count' values.
+             */
+            void getMany(const IndexType* indexes, std::size_t count, bool* values) const {
+                BoolArrayOutput output(values);
+                this->getManyImpl(indexes, count, output);
+            }
+
+
+            /**
+             * Get the values of multiple bits into a packed bitmask.
+             * Note: Bit i of the mask (i.e. bit i % 8 of byte i / 8) is the value of indexes[i].
+             * @param indexes Bit indexes (any order).
+             * @param count Number of bit indexes.
+             * @param mask Output buffer of (count + 7) / 8 bytes.
+             */
+            void getManyPacked(const IndexType* indexes, std::size_t count, byte* mask) const {
+                std::memset(mask, 0, (count + 7) / 8);
+                BitMaskOutput output(mask);
+                this->getManyImpl(indexes, count, output);
+            }
+
+
+            /**
+             * Write the indexes of the 'ON' bits to an array, in increasing order.
+             * Note: Skips empty blocks and decodes a 64 bit word at a time. To fetch the next page,
+             *       call again with startIndex set to the last written index + 1.
+             * @param values Output array (e.g. of 32 or 64 bit integers).
+             * @param capacity Maximum number of indexes to write.
+             * @param startIndex Bit index to start at.
+             * @return Number of indexes written.
+             */
+            template <typename T>
+            std::size_t toArray(T* values, const std::size_t capacity, const IndexType startIndex = 0) const {
+                std::size_t count = 0;
+                typename BitBlockContainer::size_type blockIndex = this->inverted ? startIndex / BlockSize : this->blocks.nextPresent(startIndex / BlockSize);
+                for (; blockIndex < this->blocks.size() && count < capacity; blockIndex = this->inverted ? blockIndex + 1 : this->blocks.nextPresent(blockIndex + 1)) {
+                    const IndexType blockStart = blockIndex * BlockSize;
+                    const IndexType blockOffset = startIndex > blockStart ? startIndex - blockStart : 0;
+                    count += this->blocks[blockIndex].toArray(values + count, capacity - count, blockOffset, blockStart, this->inverted);
+                }
+                if (this->inverted) {
+                    const IndexType end = this->blocks.size() * BlockSize;
+                    for (IndexType index = startIndex > end ? startIndex : end; count < capacity; ++index) {
+                        values[count++] = (T)index;
+                    }
+                }
+                return count;
+            }
+
+
+            /**
+             * Get an iterator to the first 'ON' bit.
+             * Note: Iterating an inverted bitvector does not end; use range() to bound it.
+             * @return Iterator.
+             */
+            const_iterator begin() const {
+                return const_iterator(&this->blocks, this->inverted, 0, INFINITE);
+            }
+
+
+            /**
+             * Get the end iterator.
+             * @return Iterator.
+             */
+            const_iterator end() const {
+                return const_iterator();
+            }
+
+
+            /**
+             * Get the range of 'ON' bits within the index range [begin, end).
+             * @param begin First bit index of the range.
+             * @param end Bit index after the last bit of the range (default: unbounded).
+             * @return Range of 'ON' bit indexes.
+             */
+            ConstRange range(IndexType begin, IndexType end = INFINITE) const {
+                return ConstRange(const_iterator(&this->blocks, this->inverted, begin, end), const_iterator());
+            }
+
+
+            /**
+             * Call a visitor for every 'ON' bit, in increasing order.
+             * Note: Visiting an inverted bitvector only ends when the visitor stops it.
+             * @param visitor Functor called with the bit index, returning false to stop (taken by
+             *        value like in std::for_each; hold state by reference to read it afterwards).
+             * @return False iff stopped by the visitor.
+             */
+            template <typename Visitor>
+            bool forEachSetBit(Visitor visitor) const {
+                WordToBitVisitor<Visitor> wordVisitor(visitor);
+                return this->visitSetWordsInRange(0, INFINITE, wordVisitor);
+            }
+
+
+            /**
+             * Call a visitor for every 'ON' bit within the index range [begin, end), in increasing order.
+             * @param begin First bit index of the range.
+             * @param end Bit index after the last bit of the range.
+             * @param visitor Functor called with the bit index, returning false to stop (taken by value).
+             * @return False iff stopped by the visitor.
+             */
+            template <typename Visitor>
+            bool forEachSetBitInRange(IndexType begin, IndexType end, Visitor visitor) const {
+                WordToBitVisitor<Visitor> wordVisitor(visitor);
+                return this->visitSetWordsInRange(begin, end, wordVisitor);
+            }
+
+
+            /**
+             * Call a visitor for every 64 bit word holding 'ON' bits, in increasing order.
+             * Note: Visiting an inverted bitvector only ends when the visitor stops it.
+             * @param visitor Functor called with the bit index of bit 0 of the word and the
+             *        (non-zero) word, returning false to stop (taken by value).
+             * @return False iff stopped by the visitor.
+             */
+            template <typename WordVisitor>
+            bool forEachSetWord(WordVisitor visitor) const {
+                return this->visitSetWordsInRange(0, INFINITE, visitor);
+            }
+
+
+            /**
+             * Call a visitor for every 64 bit word holding 'ON' bits within the index range [begin, end).
+             * Note: Bits outside the range are masked out of the words. Empty blocks are skipped.
+             * @param begin First bit index of the range.
+             * @param end Bit index after the last bit of the range.
+             * @param visitor Functor called with the bit index of bit 0 of the word and the
+             *        (non-zero) word, returning false to stop (taken by value).
+             * @return False iff stopped by the visitor.
+             */
+            template <typename WordVisitor>
+            bool forEachSetWordInRange(IndexType begin, IndexType end, WordVisitor visitor) const {
+                return this->visitSetWordsInRange(begin, end, visitor);
+            }
+
+
+            /**
+             * Shift all bits towards higher indexes, i.e. bit i moves to i + shift.
+             * Note: Bits shifted in at the bottom are 'OFF'. A shift by a multiple of BlockSize
+             *       only moves blocks, sharing their data; other shifts combine words.
+             * @param shift Number of bits to shift.
+             * @return This.
+             */
+            BitVector& shiftLeft(IndexType shift) {
+                const typename BitBlockContainer::size_type blockShift = shift / BlockSize;
+                const IndexType bitShift = shift % BlockSize;
+                this->rankDirectory.invalidate();
+
+                if (!this->blocks.empty()) {
+                    if (bitShift == 0) {
+                        this->blocks.insertFront(blockShift);
+                    }
+                    else {
+                        BitBlockContainer shiftedBlocks;
+                        shiftedBlocks.resize(this->blocks.size() + blockShift + 1);
+                        assignConcatRanges(shiftedBlocks, this->blocks, 0, blockShift + 1, BlockSize - bitShift, false);
+                        this->blocks.swap(shiftedBlocks);
+                    }
+                }
+
+                if (this->inverted) {
+                    this->setRange(0, shift, false);
+                }
+                this->blocks.release(0, this->blocks.size());
+                return *this;
+            }
+
+
+            /**
+             * Shift all bits towards lower indexes, i.e. bit i moves to i - shift.
+             * Note: Bits below index 'shift' are dropped. A shift by a multiple of BlockSize
+             *       only moves blocks, sharing their data; other shifts combine words.
+             * @param shift Number of bits to shift.
+             * @return This.
+             */
+            BitVector& shiftRight(IndexType shift) {
+                const typename BitBlockContainer::size_type blockShift = shift / BlockSize;
+                const IndexType bitShift = shift % BlockSize;
+                this->rankDirectory.invalidate();
+
+                if (blockShift >= this->blocks.size()) {
+                    this->blocks.clear();
+                }
+                else if (bitShift == 0) {
+                    this->blocks.eraseFront(blockShift);
+                }
+                else {
+                    BitBlockContainer shiftedBlocks;
+                    shiftedBlocks.resize(this->blocks.size() - blockShift);
+                    assignConcatRanges(shiftedBlocks, this->blocks, blockShift, 0, bitShift, false);
+                    this->blocks.swap(shiftedBlocks);
+                }
+                this->blocks.release(0, this->blocks.size());
+                return *this;
+            }
+
+
+            /**
+             * Extract the index range [begin, end) as a new bitvector, re-based to index 0.
+             * Note: Bits from index 'end - begin' onwards are 'OFF' in the result, also for an
+             *       inverted bitvector. Blocks that are covered completely and block-aligned
+             *       share their data with this bitvector; other blocks combine words.
+             * @param begin First bit index of the range.
+             * @param end Bit index after the last bit of the range.
+             * @return New bitvector.
+             */
+            BitVector slice(IndexType begin, IndexType end) const {
+                BitVector result;
+                if (begin >= end) {
+                    return result;
+                }
+                const IndexType length = end - begin;
+                const typename BitBlockContainer::size_type blockCount = 1 + (length - 1) / BlockSize;
+                const IndexType bitOffset = begin % BlockSize;
+                result.blocks.resize(blockCount);
+                assignConcatRanges(result.blocks, this->blocks, begin / BlockSize, 0, bitOffset, this->inverted);
+
+                if (this->inverted) {
+                    _BitBlock fullBlock;
+                    fullBlock.setRange(0, BlockSize, true);
+                    for (typename BitBlockContainer::size_type blockIndex = 0; blockIndex < blockCount; ++blockIndex) {
+                        result.blocks[blockIndex].bitXor(fullBlock);
+                    }
+                }
+                if (length % BlockSize && result.blocks.nextPresent(blockCount - 1) == blockCount - 1) {
+                    result.blocks[blockCount - 1].setRange(length % BlockSize, BlockSize, false);
+                }
+                result.blocks.release(0, result.blocks.size());
+                return result;
+            }
+
+
+            /**
+             * Merge the bits of another bitvector in at an offset, i.e. bit i of the other bitvector
+             * is or-ed into bit offset + i of this one.
+             * Note: Each stored block of the other bitvector is merged straight into the blocks it lands
+             *       on. For a block-aligned offset that is the block itself, whose data is shared where
+             *       this bitvector has no data; otherwise one block at a time is combined with word
+             *       shifts from two neighbouring blocks. An inverted other bitvector is shifted as a
+             *       whole first, as its 'ON' bits do not end.
+             * @param other Other bitvector.
+             * @param offset Bit index where the other bitvector starts.
+             * @return This.
+             */
+            BitVector& append(const BitVector& other, IndexType offset) {
+                if (&other == this) {
+                    const BitVector copy(other);
+                    return this->append(copy, offset);
+                }
+                if (other.inverted) {
+                    BitVector shifted(other);
+                    shifted.shiftLeft(offset);
+                    return this->bitOr(shifted);
+                }
+                static const _BitBlock emptyBitBlock;
+                const typename BitBlockContainer::size_type blockShift = offset / BlockSize;
+                const IndexType bitShift = offset % BlockSize;
+                this->rankDirectory.invalidate();
+                if (!this->inverted && !other.blocks.empty()) {
+                    const typename BitBlockContainer::size_type size = other.blocks.size() + blockShift + (bitShift ? 1 : 0);
+                    if (this->blocks.size() < size) {
+                        this->blocks.resize(size);
+                    }
+                }
+
+                const typename BitBlockContainer::size_type mySize = this->blocks.size();
+                typename BitBlockContainer::size_type nextTarget = 0;
+                for (typename BitBlockContainer::size_type sourceIndex = other.blocks.nextPresent(0); sourceIndex < other.blocks.size(); sourceIndex = other.blocks.nextPresent(sourceIndex + 1)) {
+                    // The source block lands on one target block, or on two if the offset is not block-aligned.
+                    const typename BitBlockContainer::size_type lastTarget = sourceIndex + blockShift + (bitShift ? 1 : 0);
+                    for (typename BitBlockContainer::size_type target = std::max(sourceIndex + blockShift, nextTarget); target <= lastTarget && target < mySize; ++target) {
+                        if (this->inverted && !this->blocks.get(target).hasData()) {
+                            continue; // All 'ON' already.
+                        }
+                        _BitBlock shiftedBlock;
+                        if (bitShift == 0) {
+                            shiftedBlock = other.blocks.get(sourceIndex);
+                        }
+                        else {
+                            const _BitBlock& lower = target > blockShift ? other.blocks.get(target - blockShift - 1) : emptyBitBlock;
+                            shiftedBlock.assignConcatRange(lower, other.blocks.get(target - blockShift), BlockSize - bitShift);
+                        }
+                        if (this->inverted) {
+                            this->blocks[target].template apply<operation::AND_INV, false>(shiftedBlock);
+                        }
+                        else {
+                            this->blocks[target].template apply<operation::OR, false>(shiftedBlock);
+                        }
+                    }
+                    nextTarget = lastTarget + 1;
+                }
+                this->blocks.release(blockShift, mySize);
+                return *this;
+            }
+
+
+            /**
+             * Let all blocks with equal content in a set of bitvectors share one copy of the data.
+             * Note: Bitmaps with few runs are turned into run containers first (see BitBlock::optimize).
+             *       The blocks are grouped by a hash of their content, which does not depend on the
+             *       container, and compared in full before sharing; the bits of the bitvectors do not
+             *       change, and writes copy shared data as usual.
+             * @param first Iterator to the first bitvector.
+             * @param last Iterator after the last bitvector.
+             * @return Number of blocks which were pointed at the data of another block.
+             */
+            template <typename Iterator>
+            static std::size_t compact(Iterator first, Iterator last) {
+                std::vector< std::pair<std::size_t, _BitBlock*> > hashedBlocks;
+                for (; first != last; ++first) {
+                    BitBlockContainer& blocks = first->blocks;
+                    for (typename BitBlockContainer::size_type blockIndex = blocks.nextPresent(0); blockIndex < blocks.size(); blockIndex = blocks.nextPresent(blockIndex + 1)) {
+                        _BitBlock& block = blocks[blockIndex];
+                        block.optimize();
+                        if (block.hasData() && !block.isFull()) {
+                            hashedBlocks.push_back(std::make_pair(block.hash(), &block));
+                        }
+                    }
+                }
+                std::stable_sort(hashedBlocks.begin(), hashedBlocks.end(), HashLess());
+
+                std::size_t sharedCount = 0;
+                std::vector<const _BitBlock*> distinctBlocks;
+                for (std::size_t groupBegin = 0; groupBegin < hashedBlocks.size(); ) {
+                    std::size_t groupEnd = groupBegin + 1;
+                    while (groupEnd < hashedBlocks.size() && hashedBlocks[groupEnd].first == hashedBlocks[groupBegin].first) {
+                        ++groupEnd;
+                    }
+                    distinctBlocks.clear();
+                    for (std::size_t i = groupBegin; i < groupEnd; ++i) {
+                        _BitBlock& block = *hashedBlocks[i].second;
+                        std::size_t match = 0;
+                        while (match < distinctBlocks.size() && !(*distinctBlocks[match] == block)) {
+                            ++match;
+                        }
+                        if (match == distinctBlocks.size()) {
+                            distinctBlocks.push_back(&block);
+                        }
+                        else if (!block.sharesData(*distinctBlocks[match])) {
+                            block = *distinctBlocks[match];
+                            ++sharedCount;
+                        }
+                    }
+                    groupBegin = groupEnd;
+                }
+                return sharedCount;
+            }
+
+
+            /**
+             * Let all blocks with equal content in this bitvector share one copy of the data
+             * (see the static compact method).
+             * @return Number of blocks which were pointed at the data of another block.
+             */
+            std::size_t compact() {
+                return compact(this, this + 1);
+            }
+
+
+            /**
+             * Invert the whole bitvector.
+             * Note: Instant operation, no data is touched expect the 'inverted' flag.
+             * @return This instance.
+             */
+            BitVector& invert() {
+                this->inverted = !this->inverted;
+                return *this;
+            }
+
+
+            /**
+             * Check whether the bitvector's inverted flag is on.
+             * @return True iff inverted.
+             */
+            bool isInverted() const {
+                return this->inverted;
+            }
+
+
+            /**
+             * Clear the whole bitvector (i.e. set all bits to zero).
+             * @return This instance.
+             */
+            BitVector& clear() {
+                this->inverted = false;
+                this->blocks.clear();
+                this->rankDirectory.release();
+                return *this;
+            }
+
+
+            /**
+             * Count the number of 'ON' bits in the vector.
+             * Note: If length parameter is 0 (default) and the bitvector is inverted then the
+             *       return value will be INFINITE.
+             * @param length Assumed length of the bitvector (or no assumed length if 0).
+             * @return Number of 'ON' bits or INFINITE if infinite.
+             */
+            IndexType count(IndexType length = 0) const {
+                IndexType count = 0;
+                if (length == 0) {
+                    if (this->inverted) {
+                        return INFINITE;
+                    }
+                    typename BitBlockContainer::size_type blockIndex = this->blocks.nextPresent(0);
+                    for (; blockIndex < this->blocks.size(); blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                        count += this->blocks[blockIndex].count();
+                    }
+                }
+                else {
+                    const typename BitBlockContainer::size_type endBlockIndex = length / BlockSize;
+                    const typename BitBlockContainer::size_type end = std::min(endBlockIndex, this->blocks.size());
+                    typename BitBlockContainer::size_type blockIndex = this->blocks.nextPresent(0);
+                    for (; blockIndex < end; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                        count += this->blocks[blockIndex].count();
+                    }
+
+                    const IndexType bitsLeft = length % BlockSize;
+                    if (endBlockIndex < this->blocks.size() && bitsLeft != 0) {
+                        count += this->blocks.get(endBlockIndex).count(bitsLeft);
+                    }
+
+                    count = this->inverted ? length - count : count;
+                }
+                return count;
+            }
+
+
+            /**
+             * Count the number of 'ON' bits in the index range [begin, end).
+             * Note: Only the blocks overlapping the range are counted; if the rank directory
+             *       is up to date (see rank()), it is used instead.
+             * @param begin First bit index of the range.
+             * @param end Bit index after the last bit of the range.
+             * @return Number of 'ON' bits.
+             */
+            IndexType count(IndexType begin, IndexType end) const {
+                if (begin >= end) {
+                    return 0;
+                }
+                IndexType count = 0;
+                if (this->rankDirectory.isValid()) {
+                    count = this->rankDirectory.rank(this->blocks, end) - this->rankDirectory.rank(this->blocks, begin);
+                }
+                else {
+                    typename BitBlockContainer::size_type blockIndex = this->blocks.nextPresent(begin / BlockSize);
+                    for (; blockIndex < this->blocks.size() && blockIndex * BlockSize < end; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                        const IndexType blockStart = blockIndex * BlockSize;
+                        const IndexType blockBegin = begin > blockStart ? begin - blockStart : 0;
+                        const IndexType blockEnd = end - blockStart < BlockSize ? end - blockStart : (IndexType)BlockSize;
+                        count += this->blocks[blockIndex].count(blockBegin, blockEnd);
+                    }
+                }
+                return this->inverted ? (end - begin) - count : count;
+            }
+
+
+            /**
+             * Count the number of 'ON' bits before an index.
+             * Note: Builds a rank directory on first use, which makes subsequent calls take
+             *       constant time until the bitvector is modified. Building the directory modifies
+             *       internal state, so call rank() once before sharing the bitvector between threads.
+             * @param index Bit index.
+             * @return Number of 'ON' bits in the range [0, index).
+             */
+            IndexType rank(IndexType index) const {
+                if (!this->rankDirectory.isValid()) {
+                    this->rankDirectory.build(this->blocks);
+                }
+                const IndexType count = this->rankDirectory.rank(this->blocks, index);
+                return this->inverted ? index - count : count;
+            }
+
+
+            /**
+             * Find the 'ON' bit with given rank, i.e. the inverse of rank().
+             * Note: Uses the same rank directory as rank().
+             * @param rank Rank of the bit (counting from 0).
+             * @return Index of the 'ON' bit preceded by exactly 'rank' 'ON' bits, or INFINITE if not found.
+             */
+            IndexType select(IndexType rank) const {
+                if (!this->rankDirectory.isValid()) {
+                    this->rankDirectory.build(this->blocks);
+                }
+                return this->rankDirectory.select(this->blocks, rank, !this->inverted);
+            }
+
+
+            /**
+             * Perform bitwise and operation.
+             * @param other Other bitvector.
+             * @return This.
+             */
+            BitVector& bitAnd(const BitVector& other, bool otherInverted = false) {
+                this->bitAndImpl<false>(other, otherInverted);
+                return *this;
+            }
+
+
+            /**
+             * Perform bitwise and operation with other bitvector inverted.
+             * @param other Other bitvector.
+             * @return This.
+             */
+            BitVector& bitAndInv(const BitVector& other) {
+                return this->bitAnd(other, true);
+            }
+
+
+            /**
+             * Perform bitwise and operation and count the 'ON' bits of the result in the same pass.
+             * @param other Other bitvector.
+             * @return Number of 'ON' bits in the result or INFINITE if the result is inverted.
+             */
+            IndexType bitAndCount(const BitVector& other, bool otherInverted = false) {
+                return this->bitAndImpl<true>(other, otherInverted);
+            }
+
+
+            /**
+             * Perform bitwise or operation.
+             * @param other Other bitvector.
+             * @return This.
+             */
+            BitVector& bitOr(const BitVector& other, bool otherInverted = false) {
+                this->bitOrImpl<false>(other, otherInverted);
+                return *this;
+            }
+
+
+            /**
+             * Perform bitwise xor operation with other bitvector inverted.
+             * @param other Other bitvector.
+             * @return This.
+             */
+            BitVector& bitOrInv(const BitVector& other) {
+                return this->bitOr(other, true);
+            }
+
+
+            /**
+             * Perform bitwise or operation and count the 'ON' bits of the result in the same pass.
+             * @param other Other bitvector.
+             * @return Number of 'ON' bits in the result or INFINITE if the result is inverted.
+             */
+            IndexType bitOrCount(const BitVector& other, bool otherInverted = false) {
+                return this->bitOrImpl<true>(other, otherInverted);
+            }
+
+
+            /**
+             * Perform bitwise or operation.
+             * @param other Other bitvector.
+             * @return This.
+             */
+            BitVector& bitXor(const BitVector& other, bool otherInverted = false) {
+                this->bitXorImpl<false>(other, otherInverted);
+                return *this;
+            }
+
+
+            /**
+             * Perform bitwise xor operation with other bitvector inverted.
+             * @param other Other bitvector.
+             * @return This.
+             */
+            BitVector& bitXorInv(const BitVector& other) {
+                return this->bitXor(other, true);
+            }
+
+
+            /**
+             * Perform bitwise xor operation and count the 'ON' bits of the result in the same pass.
+             * @param other Other bitvector.
+             * @return Number of 'ON' bits in the result or INFINITE if the result is inverted.
+             */
+            IndexType bitXorCount(const BitVector& other, bool otherInverted = false) {
+                return this->bitXorImpl<true>(other, otherInverted);
+            }
+
+
+            /**
+             * Count the 'ON' bits of the bitwise and of this and the other bitvector, without modifying
+             * or copying either of them.
+             * @param other Other bitvector.
+             * @return Number of 'ON' bits or INFINITE if infinite.
+             */
+            IndexType andCount(const BitVector& other) const {
+                if (this->inverted) {
+                    return other.inverted ? INFINITE : this->countApplied<operation::INV_AND>(other);
+                }
+                return other.inverted ? this->countApplied<operation::AND_INV>(other) : this->countApplied<operation::AND>(other);
+            }
+
+
+            /**
+             * Count the 'ON' bits of the bitwise or of this and the other bitvector, without modifying
+             * or copying either of them.
+             * @param other Other bitvector.
+             * @return Number of 'ON' bits or INFINITE if infinite.
+             */
+            IndexType orCount(const BitVector& other) const {
+                if (this->inverted || other.inverted) {
+                    return INFINITE;
+                }
+                return this->countApplied<operation::OR>(other);
+            }
+
+
+            /**
+             * Count the 'ON' bits of the bitwise xor of this and the other bitvector, without modifying
+             * or copying either of them.
+             * @param other Other bitvector.
+             * @return Number of 'ON' bits or INFINITE if infinite.
+             */
+            IndexType xorCount(const BitVector& other) const {
+                if (this->inverted != other.inverted) {
+                    return INFINITE;
+                }
+                return this->countApplied<operation::XOR>(other);
+            }
+
+
+            /**
+             * Count the 'ON' bits of the bitwise and of this and the inverted other bitvector (i.e. the
+             * difference), without modifying or copying either of them.
+             * @param other Other bitvector.
+             * @return Number of 'ON' bits or INFINITE if infinite.
+             */
+            IndexType andNotCount(const BitVector& other) const {
+                if (this->inverted) {
+                    return other.inverted ? this->countApplied<operation::INV_AND>(other) : INFINITE;
+                }
+                return other.inverted ? this->countApplied<operation::AND>(other) : this->countApplied<operation::AND_INV>(other);
+            }
+
+
+            /**
+             * Return the next bit-index at which the value is found.
+             * @param index Bit-index to start looking.
+             * @param value Value to look for.
+             * @return Bit-index of found occurrence or INFINITE if not found.
+             */
+            IndexType getNext(IndexType startIndex, bool value = true) const {
+                typename BitBlockContainer::size_type blockIndex = startIndex / BlockSize;
+                value = value != this->inverted;
+                if (blockIndex >= this->blocks.size()) {
+                    return value ? INFINITE : startIndex;
+                }
+                IndexType nextIndex = this->blocks.get(blockIndex).getNext(startIndex % BlockSize, value);
+
+                while (nextIndex >= BlockSize) {
+                    // 'ON' bits are only found in stored blocks, 'OFF' bits in any block which is not stored.
+                    blockIndex = value ? this->blocks.nextPresent(blockIndex + 1) : blockIndex + 1;
+                    if (blockIndex >= this->blocks.size()) {
+                        return value ? INFINITE : blockIndex * BlockSize;
                     }
-                    this->blocks.resize(blockIndex + 1);
+                    if (!value && this->blocks.nextPresent(blockIndex) != blockIndex) {
+                        return blockIndex * BlockSize;
+                    }
+                    nextIndex = this->blocks[blockIndex].getNext(0, value);
                 }
-                this->blocks[blockIndex].set(index % BlockSize, this->inverted ? !value : value);
-                return *this;
+
+                return (blockIndex * BlockSize) + nextIndex;
+            }
+
+
+            /**
+             * Return the previous bit-index (searching downwards) at which the value is found.
+             * @param startIndex Bit-index to start looking (included in the search).
+             * @param value Value to look for.
+             * @return Bit-index of found occurrence or INFINITE if not found.
+             */
+            IndexType getPrev(IndexType startIndex, bool value = true) const {
+                typename BitBlockContainer::size_type blockIndex = startIndex / BlockSize;
+                IndexType blockOffset = startIndex % BlockSize;
+                value = value != this->inverted;
+                if (blockIndex >= this->blocks.size()) {
+                    if (!value) {
+                        return startIndex;
+                    }
+                    if (this->blocks.empty()) {
+                        return INFINITE;
+                    }
+                    blockIndex = this->blocks.size() - 1;
+                    blockOffset = BlockSize - 1;
+                }
+
+                while (true) {
+                    const IndexType prevIndex = this->blocks.get(blockIndex).getPrev(blockOffset, value);
+                    if (prevIndex < BlockSize) {
+                        return (blockIndex * BlockSize) + prevIndex;
+                    }
+                    if (blockIndex == 0) {
+                        return INFINITE;
+                    }
+                    blockIndex = value ? this->blocks.prevPresent(blockIndex - 1) : blockIndex - 1;
+                    blockOffset = BlockSize - 1;
+                    if (value && blockIndex >= this->blocks.size()) {
+                        return INFINITE;
+                    }
+                    if (!value && this->blocks.prevPresent(blockIndex) != blockIndex) {
+                        return (blockIndex * BlockSize) + blockOffset;
+                    }
+                }
+            }
+
+
+            /**
+             * Return the highest bit-index with an 'ON' bit.
+             * @return Bit-index or INFINITE if there are no 'ON' bits or infinitely many (inverted bitvector).
+             */
+            IndexType last() const {
+                if (this->inverted) {
+                    return INFINITE;
+                }
+                return this->getPrev(INFINITE, true);
+            }
+
+
+            /**
+             * Test equality of this and other bitvector (other can have different BitBlock type).
+             * @param other Other bitvector.
+             * @return Bitvectors are equal (true) or different (false).
+             */
+            template <typename BB, typename BD> bool operator==(const BitVector<BB, BD>& other) const {
+                if (this->inverted != other.inverted) {
+                    return false;
+                }
+
+                // Optimized treatment if actual BitBlock sizes are equal:
+                if ((int)BlockSize == (int)BB::ActualBlockLength) {
+                    // Blocks which are not stored by either bitvector are empty in both.
+                    std::size_t blockIndex = std::min<std::size_t>(this->blocks.nextPresent(0), other.blocks.nextPresent(0));
+                    while (blockIndex < this->blocks.size() || blockIndex < other.blocks.size()) {
+                        if (this->blocks.get(blockIndex) != other.blocks.get(blockIndex)) {
+                            return false;
+                        }
+                        blockIndex = std::min<std::size_t>(this->blocks.nextPresent(blockIndex + 1), other.blocks.nextPresent(blockIndex + 1));
+                    }
+                }
+                else {
+                    const std::size_t byteIncrement = util::GCD<_BitBlock::BlockByteCount, BB::BlockByteCount>::value;
+                    std::size_t byteIndex = 0;
+                    while (true) {
+                        const std::size_t myBlockIndex = byteIndex / _BitBlock::BlockByteCount;
+                        const std::size_t otherBlockIndex = byteIndex / BB::BlockByteCount;
+                        const std::size_t myNextPresent = this->blocks.nextPresent(myBlockIndex);
+                        const std::size_t otherNextPresent = other.blocks.nextPresent(otherBlockIndex);
+                        if (myNextPresent != myBlockIndex && otherNextPresent != otherBlockIndex) {
+                            // Neither block is stored: continue at the next stored block of either bitvector.
+                            const std::size_t myNextByte = myNextPresent < this->blocks.size() ? myNextPresent * _BitBlock::BlockByteCount : ~((std::size_t)0);
+                            const std::size_t otherNextByte = otherNextPresent < other.blocks.size() ? otherNextPresent * BB::BlockByteCount : ~((std::size_t)0);
+                            byteIndex = std::min(myNextByte, otherNextByte);
+                            if (byteIndex == ~((std::size_t)0)) {
+                                break;
+                            }
+                            continue;
+                        }
+                        const _BitBlock* myBlock = myBlockIndex < this->blocks.size() ? &this->blocks.get(myBlockIndex) : NULL;
+                        const BB* otherBlock = otherBlockIndex < other.blocks.size() ? &other.blocks.get(otherBlockIndex) : NULL;
+                        const std::size_t myBlockOffset = byteIndex % _BitBlock::BlockByteCount;
+                        const std::size_t otherBlockOffset = byteIndex % BB::BlockByteCount;
+                        if (myBlock) {
+                            if (!myBlock->equalRange(myBlockOffset, otherBlock, otherBlockOffset, byteIncrement)) {
+                                return false;
+                            }
+                        }
+                        else if (otherBlock) {
+                            if (!otherBlock->equalRange(otherBlockOffset, myBlock, myBlockOffset, byteIncrement)) {
+                                return false;
+                            }
+                        }
+                        else {
+                            break;
+                        }
+
+                        byteIndex += byteIncrement;
+                    }
+                }
+
+                return true;
+            }
+
+
+            /**
+             * Test equality of this and other bitvector (other uses a different BitBlock type).
+             * @param other Other bitvector.
+             * @return Bitvectors are equal (true) or different (false).
+             */
+            template <typename BB, typename BD> bool operator!=(const BitVector<BB, BD>& other) const {
+                return !(*this == other);
+            }
+
+
+            /**
+             * Serialize the bitvector.
+             * @param serializer Serializer.
+             * @return Success (true) or failure (false).
+             */
+            bool serialize(ISerializer& serializer) const {
+                serializer.start();
+                if (serializer.failed()) {
+                    return false;
+                }
+                serializer.setInverted(this->inverted);
+                if (serializer.failed()) {
+                    return false;
+                }
+                typename BitBlockContainer::size_type nextBlockIndex = 0;
+                typename BitBlockContainer::size_type blockIndex = this->blocks.nextPresent(0);
+                for (; blockIndex < this->blocks.size(); blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                    if (blockIndex > nextBlockIndex) {
+                        serializer.addEmptyBytes((blockIndex - nextBlockIndex) * _BitBlock::BlockByteCount);
+                    }
+                    this->blocks[blockIndex].serialize(serializer);
+                    if (serializer.failed()) {
+                        return false;
+                    }
+                    nextBlockIndex = blockIndex + 1;
+                }
+                serializer.end();
+                return !serializer.failed();
+            }
+
+
+            /**
+             * Deserialize the bitvector.
+             * @param deserializer Deserializer.
+             * @return Success (true) or failure (false).
+             */
+            bool deserialize(IDeserializer& deserializer) {
+                std::size_t blockIndex = 0;
+
+                this->rankDirectory.invalidate();
+                deserializer.start();
+                while (!deserializer.finished()) {
+                    const std::size_t emptyBlockCount = deserializer.skipEmptyBlocks(_BitBlock::BlockByteCount);
+                    if (emptyBlockCount > 0) {
+                        typename BitBlockContainer::size_type skippedIndex = this->blocks.nextPresent(blockIndex);
+                        for (; skippedIndex < this->blocks.size() && skippedIndex < blockIndex + emptyBlockCount; skippedIndex = this->blocks.nextPresent(skippedIndex + 1)) {
+                            this->blocks[skippedIndex] = _BitBlock();
+                        }
+                        blockIndex += emptyBlockCount;
+                        continue;
+                    }
+                    if (blockIndex >= this->blocks.size()) {
+                        this->blocks.resize(blockIndex + 1);
+                    }
+                    this->blocks[blockIndex].deserialize(deserializer);
+                    blockIndex += 1;
+                }
+
+                if (deserializer.failed()) {
+                    return false;
+                }
+
+                this->blocks.resize(blockIndex);
+                this->blocks.release(0, this->blocks.size());
+                this->inverted = deserializer.isInverted();
+                return true;
             }
 
 
+        private:
             /**
-             * Get the bit value at the specified index.
-             * @param index Bit index.
-             * @return On (true) or off (false).
+             * Word visitor calling a bit visitor for every 'ON' bit of the word.
              */
-            bool get(IndexType index) const {
-                const typename BitBlockContainer::size_type blockIndex = index / BlockSize;
-                const bool indexContained = blockIndex < this->blocks.size();
-                if (!indexContained) {
-                    return this->inverted;
+            template <typename Visitor>
+            struct WordToBitVisitor {
+                explicit WordToBitVisitor(Visitor& visitor) : visitor(visitor) {}
+                bool operator()(IndexType wordStart, unsigned long long word) {
+                    for (; word; word &= word - 1) {
+                        if (!this->visitor(wordStart + util::countTrailingZeros(word))) {
+                            return false;
+                        }
+                    }
+                    return true;
                 }
-                const bool value = this->blocks[blockIndex].get(index % BlockSize);
-                return this->inverted ? !value : value;
-            }
+                Visitor& visitor;
+            };
 
 
             /**
-             * Invert the whole bitvector.
-             * Note: Instant operation, no data is touched expect the 'inverted' flag.
-             * @return This instance.
+             * Call a visitor for every 64 bit word holding 'ON' bits within the index range [begin, end)
+             * (see forEachSetWordInRange()).
+             * @param begin First bit index of the range.
+             * @param end Bit index after the last bit of the range.
+             * @param visitor Functor called with the bit index of bit 0 of the word and the word.
+             * @return False iff stopped by the visitor.
              */
-            BitVector& invert() {
-                this->inverted = !this->inverted;
-                return *this;
+            template <typename WordVisitor>
+            bool visitSetWordsInRange(IndexType begin, IndexType end, WordVisitor& visitor) const {
+                const unsigned long long flipMask = this->inverted ? ~0ULL : 0;
+                for (typename BitBlockContainer::size_type blockIndex = begin / BlockSize; ; ++blockIndex) {
+                    if (!this->inverted) {
+                        blockIndex = this->blocks.nextPresent(blockIndex);
+                    }
+                    const bool blockContained = blockIndex < this->blocks.size();
+                    if (!blockContained && !this->inverted) {
+                        return true;
+                    }
+                    const IndexType blockStart = blockIndex * BlockSize;
+                    if (blockStart >= end) {
+                        return true;
+                    }
+                    const _BitBlock* const block = blockContained ? &this->blocks[blockIndex] : NULL;
+                    if (!this->inverted && !block->hasData()) {
+                        continue;
+                    }
+
+                    IndexType wordIndex = begin > blockStart ? (begin - blockStart) / 64 : 0;
+                    for (; wordIndex < _BitBlock::WordCount; ++wordIndex) {
+                        const IndexType wordStart = blockStart + wordIndex * 64;
+                        if (wordStart >= end) {
+                            return true;
+                        }
+                        unsigned long long word = ((block ? block->getWord(wordIndex) : 0) ^ flipMask) & _BitBlock::getWordMask(wordIndex);
+                        if (begin > wordStart) {
+                            word &= ~0ULL << (begin - wordStart);
+                        }
+                        if (end - wordStart < 64) {
+                            word &= ~(~0ULL << (end - wordStart));
+                        }
+                        if (!word) {
+                            if (!this->inverted && wordIndex + 1 < _BitBlock::WordCount) {
+                                // Jump to the word holding the next 'ON' bit of the block.
+                                const IndexType next = block->getNext((wordIndex + 1) * 64, true);
+                                wordIndex = (next < BlockSize ? next / 64 : (IndexType)_BitBlock::WordCount) - 1;
+                            }
+                        }
+                        else if (!visitor(wordStart, word)) {
+                            return false;
+                        }
+                    }
+                }
             }
 
 
             /**
-             * Check whether the bitvector's inverted flag is on.
-             * @return True iff inverted.
+             * Output functor writing values to a bool array.
              */
-            bool isInverted() const {
-                return this->inverted;
-            }
+            struct BoolArrayOutput {
+                explicit BoolArrayOutput(bool* values) : values(values) {}
+                void operator()(bool value) {
+                    *this->values++ = value;
+                }
+                bool* values;
+            };
 
 
             /**
-             * Clear the whole bitvector (i.e. set all bits to zero).
-             * @return This instance.
+             * Output functor writing values to a packed bitmask (which should be cleared).
              */
-            BitVector& clear() {
-                this->inverted = false;
-                this->blocks.clear();
-                return *this;
-            }
+            struct BitMaskOutput {
+                explicit BitMaskOutput(byte* mask) : mask(mask), index(0) {}
+                void operator()(bool value) {
+                    this->mask[this->index / 8] |= (byte)value << (this->index % 8);
+                    ++this->index;
+                }
+                byte* mask;
+                std::size_t index;
+            };
 
 
             /**
-             * Count the number of 'ON' bits in the vector.
-             * Note: If length parameter is 0 (default) and the bitvector is inverted then the
-             *       return value will be INFINITE.
-             * @param length Assumed length of the bitvector (or no assumed length if 0).
-             * @return Number of 'ON' bits or INFINITE if infinite.
+             * Get the values of multiple bits.
+             * @param indexes Bit indexes (any order).
+             * @param count Number of bit indexes.
+             * @param output Functor called with the value of every bit, in order.
              */
-            IndexType count(IndexType length = 0) const {
-                IndexType count = 0;
-                if (length == 0) {
-                    if (this->inverted) {
-                        return INFINITE;
+            template <typename Output>
+            void getManyImpl(const IndexType* indexes, std::size_t count, Output& output) const {
+                static const std::size_t PREFETCH_DISTANCE = 8;
+                const IndexType* first = indexes;
+                const IndexType* const last = indexes + count;
+                while (first != last) {
+                    if (last - first > (std::ptrdiff_t)PREFETCH_DISTANCE) {
+                        const IndexType ahead = first[PREFETCH_DISTANCE];
+                        if (ahead / BlockSize < this->blocks.size()) {
+                            this->blocks.get(ahead / BlockSize).prefetch(ahead % BlockSize);
+                        }
                     }
-                    for (typename BitBlockContainer::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
-                        count += it->count();
+
+                    const typename BitBlockContainer::size_type blockIndex = *first / BlockSize;
+                    const IndexType blockStart = blockIndex * BlockSize;
+                    const IndexType* blockLast = first + 1;
+                    while (blockLast != last && *blockLast - blockStart < BlockSize) {
+                        ++blockLast;
                     }
-                }
-                else {
-                    const typename BitBlockContainer::size_type endBlockIndex = length / BlockSize;
-                    const bool indexContained = endBlockIndex < this->blocks.size();
-                    typename BitBlockContainer::const_iterator it = this->blocks.begin();
-                    const typename BitBlockContainer::const_iterator end = indexContained ? it + endBlockIndex : this->blocks.end();
-                    for (; it != end; ++it) {
-                        count += it->count();
+                    if (blockIndex < this->blocks.size()) {
+                        this->blocks.get(blockIndex).getMany(first, blockLast, blockStart, this->inverted, output);
                     }
-
-                    const IndexType bitsLeft = length % BlockSize;
-                    if (it != this->blocks.end() && bitsLeft != 0) {
-                        count += it->count(bitsLeft);
+                    else {
+                        for (const IndexType* it = first; it != blockLast; ++it) {
+                            output(this->inverted);
+                        }
                     }
-
-                    count = this->inverted ? length - count : count;
+                    first = blockLast;
                 }
-                return count;
             }
 
 
             /**
-             * Perform bitwise and operation.
+             * Perform bitwise and operation, optionally counting the result.
              * @param other Other bitvector.
-             * @return This.
+             * @param otherInverted Use the other bitvector inverted.
+             * @return Number of 'ON' bits in the result if WithCount is set (INFINITE if inverted), otherwise 0.
              */
-            BitVector& bitAnd(const BitVector& other, bool otherInverted = false) {
-                static const _BitBlock emptyBitBlock;
+            template <bool WithCount>
+            IndexType bitAndImpl(const BitVector& other, bool otherInverted) {
+                this->rankDirectory.invalidate();
                 otherInverted = otherInverted ? !other.inverted : other.inverted;
                 bool isFinallyInverted = this->inverted && otherInverted;
 
@@ -1025,67 +5937,61 @@ namespace bitlib2 {
                     if (this->blocks.size() < other.blocks.size()) {
                         this->blocks.resize(other.blocks.size());
                     }
+                    // Blocks of the other bitvector turn blocks of this one on or off.
+                    this->blocks.addPresent(other.blocks, other.blocks.size());
                 }
 
-                typename BitBlockContainer::iterator myIt = this->blocks.begin();
-                typename BitBlockContainer::const_iterator otherIt = other.blocks.begin();
-                const typename BitBlockContainer::const_iterator myItEnd = this->blocks.end();
-                const typename BitBlockContainer::const_iterator otherItEnd = other.blocks.end();
+                IndexType count = 0;
+                const typename BitBlockContainer::size_type mySize = this->blocks.size();
+                const typename BitBlockContainer::size_type end = std::min(mySize, other.blocks.size());
+                typename BitBlockContainer::size_type blockIndex = this->blocks.nextPresent(0);
 
                 if (this->inverted) {
                     if (otherInverted) {
-                        for (; myIt != myItEnd; ++myIt) {
-                            const _BitBlock* otherBitBlock = &(*otherIt);
-                            if (otherIt != otherItEnd) {
-                                ++otherIt;
-                            }
-                            else {
-                                otherBitBlock = &emptyBitBlock;
-                            }
-                            myIt->bitOr(*otherBitBlock);
+                        for (; blockIndex < end; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                            this->blocks[blockIndex].template apply<operation::OR, false>(other.blocks.get(blockIndex));
                         }
                     }
                     else {
-                        for (; myIt != myItEnd; ++myIt, ++otherIt) {
-                            myIt->bitInvAnd(*otherIt);
+                        for (; blockIndex < end; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                            count += this->blocks[blockIndex].template apply<operation::INV_AND, WithCount>(other.blocks.get(blockIndex));
                         }
                     }
                 }
                 else {
                     if (otherInverted) {
-                        for (; myIt != myItEnd && otherIt != otherItEnd; ++myIt, ++otherIt) {
-                            myIt->bitAndInv(*otherIt);
+                        for (; blockIndex < end; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                            count += this->blocks[blockIndex].template apply<operation::AND_INV, WithCount>(other.blocks.get(blockIndex));
                         }
                     }
                     else {
-                        for (; myIt != myItEnd; ++myIt, ++otherIt) {
-                            myIt->bitAnd(*otherIt);
+                        for (; blockIndex < end; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                            count += this->blocks[blockIndex].template apply<operation::AND, WithCount>(other.blocks.get(blockIndex));
                         }
                     }
                 }
 
-                this->inverted = isFinallyInverted;
-                return *this;
-            }
-
+                if (WithCount && !isFinallyInverted) {
+                    for (; blockIndex < mySize; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                        count += this->blocks[blockIndex].count();
+                    }
+                }
 
-            /**
-             * Perform bitwise and operation with other bitvector inverted.
-             * @param other Other bitvector.
-             * @return This.
-             */
-            BitVector& bitAndInv(const BitVector& other) {
-                return this->bitAnd(other, true);
+                this->inverted = isFinallyInverted;
+                this->blocks.release(0, this->blocks.size());
+                return WithCount && isFinallyInverted ? INFINITE : count;
             }
 
 
             /**
-             * Perform bitwise or operation.
+             * Perform bitwise or operation, optionally counting the result.
              * @param other Other bitvector.
-             * @return This.
+             * @param otherInverted Use the other bitvector inverted.
+             * @return Number of 'ON' bits in the result if WithCount is set (INFINITE if inverted), otherwise 0.
              */
-            BitVector& bitOr(const BitVector& other, bool otherInverted = false) {
-                static const _BitBlock emptyBitBlock;
+            template <bool WithCount>
+            IndexType bitOrImpl(const BitVector& other, bool otherInverted) {
+                this->rankDirectory.invalidate();
                 otherInverted = otherInverted ? !other.inverted : other.inverted;
                 bool isFinallyInverted = this->inverted || otherInverted;
 
@@ -1099,247 +6005,182 @@ namespace bitlib2 {
                     if (this->blocks.size() < other.blocks.size()) {
                         this->blocks.resize(other.blocks.size());
                     }
+                    // Blocks of the other bitvector turn blocks of this one on or off.
+                    this->blocks.addPresent(other.blocks, other.blocks.size());
                 }
 
-                typename BitBlockContainer::iterator myIt = this->blocks.begin();
-                typename BitBlockContainer::const_iterator otherIt = other.blocks.begin();
-                const typename BitBlockContainer::const_iterator myItEnd = this->blocks.end();
-                const typename BitBlockContainer::const_iterator otherItEnd = other.blocks.end();
+                IndexType count = 0;
+                const typename BitBlockContainer::size_type mySize = this->blocks.size();
+                const typename BitBlockContainer::size_type end = std::min(mySize, other.blocks.size());
+                typename BitBlockContainer::size_type blockIndex = this->blocks.nextPresent(0);
 
                 if (this->inverted) {
                     if (otherInverted) {
-                        for (; myIt != myItEnd; ++myIt, ++otherIt) {
-                            myIt->bitAnd(*otherIt);
+                        for (; blockIndex < end; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                            this->blocks[blockIndex].template apply<operation::AND, false>(other.blocks.get(blockIndex));
                         }
                     }
                     else {
-                        for (; myIt != myItEnd && otherIt != otherItEnd; ++myIt, ++otherIt) {
-                            myIt->bitAndInv(*otherIt);
+                        for (; blockIndex < end; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                            this->blocks[blockIndex].template apply<operation::AND_INV, false>(other.blocks.get(blockIndex));
                         }
                     }
                 }
                 else {
                     if (otherInverted) {
-                        for (; myIt != myItEnd; ++myIt, ++otherIt) {
-                            myIt->bitInvAnd(*otherIt);
+                        for (; blockIndex < end; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                            this->blocks[blockIndex].template apply<operation::INV_AND, false>(other.blocks.get(blockIndex));
                         }
                     }
                     else {
-                        for (; myIt != myItEnd && otherIt != otherItEnd; ++myIt, ++otherIt) {
-                            myIt->bitOr(*otherIt);
+                        for (; blockIndex < end; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                            count += this->blocks[blockIndex].template apply<operation::OR, WithCount>(other.blocks.get(blockIndex));
                         }
                     }
                 }
 
-                this->inverted = isFinallyInverted;
-                return *this;
-            }
-
+                if (WithCount && !isFinallyInverted) {
+                    for (; blockIndex < mySize; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                        count += this->blocks[blockIndex].count();
+                    }
+                }
 
-            /**
-             * Perform bitwise xor operation with other bitvector inverted.
-             * @param other Other bitvector.
-             * @return This.
-             */
-            BitVector& bitOrInv(const BitVector& other) {
-                return this->bitOr(other, true);
+                this->inverted = isFinallyInverted;
+                this->blocks.release(0, this->blocks.size());
+                return WithCount && isFinallyInverted ? INFINITE : count;
             }
 
 
             /**
-             * Perform bitwise or operation.
+             * Perform bitwise xor operation, optionally counting the result.
              * @param other Other bitvector.
-             * @return This.
+             * @param otherInverted Use the other bitvector inverted.
+             * @return Number of 'ON' bits in the result if WithCount is set (INFINITE if inverted), otherwise 0.
              */
-            BitVector& bitXor(const BitVector& other, bool otherInverted = false) {
-                static const _BitBlock emptyBitBlock;
+            template <bool WithCount>
+            IndexType bitXorImpl(const BitVector& other, bool otherInverted) {
+                this->rankDirectory.invalidate();
                 otherInverted = otherInverted ? !other.inverted : other.inverted;
                 this->inverted = this->inverted != otherInverted;
 
                 if (this->blocks.size() < other.blocks.size()) {
                     this->blocks.resize(other.blocks.size());
                 }
+                this->blocks.addPresent(other.blocks, other.blocks.size());
 
-                typename BitBlockContainer::iterator myIt = this->blocks.begin();
-                typename BitBlockContainer::const_iterator otherIt = other.blocks.begin();
-                const typename BitBlockContainer::const_iterator myItEnd = this->blocks.end();
-                const typename BitBlockContainer::const_iterator otherItEnd = other.blocks.end();
+                const bool countBlocks = WithCount && !this->inverted;
+                IndexType count = 0;
+                const typename BitBlockContainer::size_type mySize = this->blocks.size();
+                const typename BitBlockContainer::size_type end = other.blocks.size();
+                typename BitBlockContainer::size_type blockIndex = this->blocks.nextPresent(0);
 
-                for (; myIt != myItEnd && otherIt != otherItEnd; ++myIt, ++otherIt) {
-                    myIt->bitXor(*otherIt);
+                if (countBlocks) {
+                    for (; blockIndex < end; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                        count += this->blocks[blockIndex].template apply<operation::XOR, true>(other.blocks.get(blockIndex));
+                    }
+                    for (; blockIndex < mySize; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                        count += this->blocks[blockIndex].count();
+                    }
+                }
+                else {
+                    for (; blockIndex < end; blockIndex = this->blocks.nextPresent(blockIndex + 1)) {
+                        this->blocks[blockIndex].template apply<operation::XOR, false>(other.blocks.get(blockIndex));
+                    }
                 }
 
-                return *this;
-            }
-
-
-            /**
-             * Perform bitwise xor operation with other bitvector inverted.
-             * @param other Other bitvector.
-             * @return This.
-             */
-            BitVector& bitXorInv(const BitVector& other) {
-                return this->bitXor(other, true);
+                this->blocks.release(0, this->blocks.size());
+                return WithCount && !countBlocks ? INFINITE : count;
             }
 
 
             /**
-             * Return the next bit-index at which the value is found.
-             * @param index Bit-index to start looking.
-             * @param value Value to look for.
-             * @return Bit-index of found occurrence or INFINITE if not found.
+             * Order hashed blocks by hash only.
              */
-            IndexType getNext(IndexType startIndex, bool value = true) const {
-                typename BitBlockContainer::size_type blockIndex = startIndex / BlockSize;
-                value = value != this->inverted;
-                if (blockIndex >= this->blocks.size()) {
-                    return value ? INFINITE : startIndex;
-                }
-                IndexType nextIndex = this->blocks[blockIndex].getNext(startIndex % BlockSize, value);
-
-                while (nextIndex >= BlockSize) {
-                    blockIndex++;
-                    if (blockIndex >= this->blocks.size()) {
-                        return value ? INFINITE : blockIndex * BlockSize;
-                    }
-                    nextIndex = this->blocks[blockIndex].getNext(0, value);
+            struct HashLess {
+                bool operator()(const std::pair<std::size_t, _BitBlock*>& a, const std::pair<std::size_t, _BitBlock*>& b) const {
+                    return a.first < b.first;
                 }
-
-                return (blockIndex * BlockSize) + nextIndex;
-            }
+            };
 
 
             /**
-             * Test equality of this and other bitvector (other can have different BitBlock type).
-             * @param other Other bitvector.
-             * @return Bitvectors are equal (true) or different (false).
+             * Assign block-length ranges of the concatenated source blocks to the target blocks: target
+             * block i gets the bits from bit 'offset' of source block i - targetBase + sourceBase on,
+             * continued in the next source block (source blocks before index 0 are empty).
+             * Note: Only the target blocks overlapping stored source blocks are assigned, unless
+             *       allTargets is set.
+             * @param target Target blocks (resized by the caller, without data).
+             * @param source Source blocks.
+             * @param sourceBase Source block index corresponding to targetBase.
+             * @param targetBase Target block index corresponding to sourceBase.
+             * @param offset Bit offset within the source blocks.
+             * @param allTargets Assign all target blocks.
              */
-            template <typename BB> bool operator==(const BitVector<BB>& other) const {
-                if (this->inverted != other.inverted) {
-                    return false;
-                }
-
-                // Optimized treatment if actual BitBlock sizes are equal:
-                if ((int)BlockSize == (int)BB::ActualBlockLength) {
-                    const std::size_t blockIndexCount = this->blocks.size() > other.blocks.size() ? this->blocks.size() : other.blocks.size();
-                    for (std::size_t blockIndex = 0; blockIndex < blockIndexCount; ++blockIndex) {
-                        const _BitBlock* myBlock = blockIndex < this->blocks.size() ? &this->blocks[blockIndex] : NULL;
-                        const BB* otherBlock = blockIndex < other.blocks.size() ? &other.blocks[blockIndex] : NULL;
-                        if (myBlock && otherBlock) {
-                            if (*myBlock != *otherBlock) {
-                                return false;
-                            }
-                        }
-                        else if (myBlock) {
-                            if (myBlock->count() > 0) {
-                                return false;
-                            }
+            static void assignConcatRanges(BitBlockContainer& target, const BitBlockContainer& source,
+                    typename BitBlockContainer::size_type sourceBase, typename BitBlockContainer::size_type targetBase, IndexType offset, bool allTargets) {
+                static const _BitBlock emptyBitBlock;
+                typename BitBlockContainer::size_type blockIndex = 0;
+                typename BitBlockContainer::size_type sourceIndex = source.nextPresent(sourceBase > targetBase ? sourceBase - targetBase : 0);
+                while (blockIndex < target.size()) {
+                    if (!allTargets) {
+                        // Skip to the first target block overlapping the next stored source block.
+                        if (sourceIndex >= source.size()) {
+                            return;
                         }
-                        else if (otherBlock) {
-                            if (otherBlock->count() > 0) {
-                                return false;
-                            }
+                        const typename BitBlockContainer::size_type lowerTarget = sourceIndex + targetBase - sourceBase;
+                        blockIndex = std::max(blockIndex, lowerTarget > 0 && offset ? lowerTarget - 1 : lowerTarget);
+                        if (blockIndex > lowerTarget) {
+                            sourceIndex = source.nextPresent(sourceIndex + 1);
+                            continue;
                         }
                     }
-                }
-                else {
-                    const std::size_t byteIncrement = util::GCD<_BitBlock::BlockByteCount, BB::BlockByteCount>::value;
-                    std::size_t byteIndex = 0;
-                    while (true) {
-                        const std::size_t myBlockIndex = byteIndex / _BitBlock::BlockByteCount;
-                        const std::size_t otherBlockIndex = byteIndex / BB::BlockByteCount;
-                        const _BitBlock* myBlock = myBlockIndex < this->blocks.size() ? &this->blocks[myBlockIndex] : NULL;
-                        const BB* otherBlock = otherBlockIndex < other.blocks.size() ? &other.blocks[otherBlockIndex] : NULL;
-                        const std::size_t myBlockOffset = byteIndex % _BitBlock::BlockByteCount;
-                        const std::size_t otherBlockOffset = byteIndex % BB::BlockByteCount;
-                        if (myBlock) {
-                            if (!myBlock->equalRange(myBlockOffset, otherBlock, otherBlockOffset, byteIncrement)) {
-                                return false;
-                            }
-                        }
-                        else if (otherBlock) {
-                            if (!otherBlock->equalRange(otherBlockOffset, myBlock, myBlockOffset, byteIncrement)) {
-                                return false;
-                            }
-                        }
-                        else {
-                            break;
-                        }
-
-                        byteIndex += byteIncrement;
+                    if (blockIndex >= target.size()) {
+                        return;
                     }
+                    const typename BitBlockContainer::size_type lowerIndex = blockIndex + sourceBase;
+                    const _BitBlock& lower = lowerIndex >= targetBase ? source.get(lowerIndex - targetBase) : emptyBitBlock;
+                    const _BitBlock& upper = offset && lowerIndex + 1 >= targetBase ? source.get(lowerIndex + 1 - targetBase) : emptyBitBlock;
+                    target[blockIndex].assignConcatRange(lower, upper, offset);
+                    ++blockIndex;
                 }
-
-                return true;
             }
 
 
             /**
-             * Test equality of this and other bitvector (other uses a different BitBlock type).
+             * Count the 'ON' bits of a bitwise operation on the blocks of this and the other bitvector
+             * (ignoring the inverted flags). Missing blocks count as empty blocks.
              * @param other Other bitvector.
-             * @return Bitvectors are equal (true) or different (false).
-             */
-            template <typename BB> bool operator!=(const BitVector<BB>& other) const {
-                return !(*this == other);
-            }
-
-
-            /**
-             * Serialize the bitvector.
-             * @param serializer Serializer.
-             * @return Success (true) or failure (false).
+             * @return Number of 'ON' bits.
              */
-            bool serialize(ISerializer& serializer) const {
-                serializer.start();
-                if (serializer.failed()) {
-                    return false;
-                }
-                serializer.setInverted(this->inverted);
-                if (serializer.failed()) {
-                    return false;
+            template <int Operation>
+            IndexType countApplied(const BitVector& other) const {
+                const typename BitBlockContainer::size_type mySize = this->blocks.size();
+                const typename BitBlockContainer::size_type otherSize = other.blocks.size();
+                typename BitBlockContainer::size_type size = mySize > otherSize ? mySize : otherSize;
+                if (Operation == operation::AND) {
+                    size = mySize < otherSize ? mySize : otherSize;
                 }
-                typename BitBlockContainer::const_iterator it = this->blocks.begin();
-                for (; it != this->blocks.end(); ++it) {
-                    it->serialize(serializer);
-                    if (serializer.failed()) {
-                        return false;
-                    }
+                else if (Operation == operation::AND_INV) {
+                    size = mySize;
                 }
-                serializer.end();
-                return !serializer.failed();
-            }
-
-
-            /**
-             * Deserialize the bitvector.
-             * @param deserializer Deserializer.
-             * @return Success (true) or failure (false).
-             */
-            bool deserialize(IDeserializer& deserializer) {
-                std::size_t blockIndex = 0;
-
-                deserializer.start();
-                while (!deserializer.finished()) {
-                    if (blockIndex >= this->blocks.size()) {
-                        this->blocks.resize(blockIndex + 1);
-                    }
-                    this->blocks[blockIndex].deserialize(deserializer);
-                    blockIndex += 1;
+                else if (Operation == operation::INV_AND) {
+                    size = otherSize;
                 }
 
-                if (deserializer.failed()) {
-                    return false;
+                // Blocks which are not stored by either bitvector count as empty in both.
+                IndexType count = 0;
+                typename BitBlockContainer::size_type blockIndex = std::min(this->blocks.nextPresent(0), other.blocks.nextPresent(0));
+                while (blockIndex < size) {
+                    count += this->blocks.get(blockIndex).template countApplied<Operation>(other.blocks.get(blockIndex));
+                    blockIndex = std::min(this->blocks.nextPresent(blockIndex + 1), other.blocks.nextPresent(blockIndex + 1));
                 }
-
-                this->blocks.resize(blockIndex);
-                this->inverted = deserializer.isInverted();
-                return true;
+                return count;
             }
 
 
-        private:
             bool inverted;
             BitBlockContainer blocks;
+            mutable RankDirectory<_BitBlock> rankDirectory; // Built on demand by rank().
     };
 
 
@@ -20,6 +20,7 @@ namespace serialize {
                 SEGMENTTYPE_INVERTED = 1,
                 SEGMENTTYPE_EMPTYBLOCK_32BIT = 2, // 32 bit length
                 SEGMENTTYPE_BLOCK_32BIT = 3, // 32 bit length
+                SEGMENTTYPE_RUNS_32BIT = 4, // 32 bit length, 32 bit run count, 16 bit first and last index per run
                 SEGMENTTYPE_END = 255,
             };
 
@@ -87,12 +88,38 @@ namespace serialize {
 
             /**
              * Add empty bytes.
+             * Note: Counts beyond the 32 bit length are written as several segments.
              * @param bytesCount Number of empty bytes.
              */
             virtual void addEmptyBytes(std::size_t bytesCount) {
+                static const std::size_t maxSegmentBytes = 0xFFFFFFFFUL;
                 byte data[5] = { SEGMENTTYPE_EMPTYBLOCK_32BIT };
+                do {
+                    const std::size_t segmentBytes = std::min(bytesCount, maxSegmentBytes);
+                    writeIntToByteBuffer(segmentBytes, &data[1]);
+                    this->outputStream.write(reinterpret_cast<const char*>(data), 5);
+                    bytesCount -= segmentBytes;
+                } while (bytesCount > 0);
+            }
+
+
+            /**
+             * Add runs of 'ON' bits.
+             * @param runs Pairs of the first and last bit index of every run.
+             * @param runCount Number of runs.
+             * @param bytesCount Number of bytes covered by the runs.
+             * Note: The number of 'ON' bits is not written; it follows from the runs.
+             */
+            virtual void addRuns(const unsigned short* runs, std::size_t runCount, std::size_t bytesCount, std::size_t /* onBitCount */) {
+                byte data[9] = { SEGMENTTYPE_RUNS_32BIT };
                 writeIntToByteBuffer(bytesCount, &data[1]);
-                this->outputStream.write(reinterpret_cast<const char*>(data), 5);
+                writeIntToByteBuffer(runCount, &data[5]);
+                this->outputStream.write(reinterpret_cast<const char*>(data), 9);
+                for (std::size_t i = 0; i < 2 * runCount; ++i) {
+                    data[0] = runs[i] & 0xFF;
+                    data[1] = runs[i] >> 8;
+                    this->outputStream.write(reinterpret_cast<const char*>(data), 2);
+                }
             }
 
 
@@ -127,7 +154,8 @@ namespace serialize {
                 fail(false),
                 inverted(false),
                 currentSegmentType(StreamSerializer::SEGMENTTYPE_START),
-                currentSegmentDataLeft(0)
+                currentSegmentDataLeft(0),
+                currentSegmentSize(0)
             {
             }
 
@@ -215,6 +243,21 @@ namespace serialize {
                             }
                             break;
 
+                        case StreamSerializer::SEGMENTTYPE_RUNS_32BIT:
+                            if (this->currentSegmentDataLeft > 0) {
+                                const std::size_t readSize = std::min(bytesCount, this->currentSegmentDataLeft);
+                                this->expandRuns(data, readSize);
+                                this->currentSegmentDataLeft -= readSize;
+                                data += readSize;
+                                bytesCount -= readSize;
+                                empty = false;
+                                isDataRead = true;
+                                if (this->currentSegmentDataLeft > 0) {
+                                    return true;
+                                }
+                            }
+                            break;
+
                         default:
                             break;
                     }
@@ -225,6 +268,55 @@ namespace serialize {
             }
 
 
+            /**
+             * Check whether the next bit data are runs covering exactly a given number of bytes.
+             * @param bytesCount Number of bytes the runs have to cover.
+             * @return Number of runs or -1 if the next data are no such runs.
+             */
+            virtual std::size_t getRunCount(std::size_t bytesCount) {
+                while (this->currentSegmentDataLeft == 0 && this->currentSegmentType != StreamSerializer::SEGMENTTYPE_END) {
+                    this->readSegmentHead();
+                }
+                if (this->currentSegmentType != StreamSerializer::SEGMENTTYPE_RUNS_32BIT
+                        || this->currentSegmentDataLeft != bytesCount || this->currentSegmentSize != bytesCount) {
+                    return (std::size_t)-1;
+                }
+                return this->currentRuns.size() / 2;
+            }
+
+
+            /**
+             * Deserialize the runs announced by getRunCount().
+             * @param runs Buffer for the pairs of the first and last bit index of every run.
+             */
+            virtual void getRuns(unsigned short* runs) {
+                std::copy(this->currentRuns.begin(), this->currentRuns.end(), runs);
+                this->currentSegmentDataLeft = 0;
+            }
+
+
+            /**
+             * Skip the next bit data if they are empty, in whole numbers of blocks.
+             * @param bytesCount Number of bytes per block.
+             * @return Number of empty blocks skipped.
+             */
+            virtual std::size_t skipEmptyBlocks(std::size_t bytesCount) {
+                std::size_t blockCount = 0;
+                while (true) {
+                    while (this->currentSegmentDataLeft == 0 && this->currentSegmentType != StreamSerializer::SEGMENTTYPE_END) {
+                        this->readSegmentHead();
+                    }
+                    if (this->currentSegmentType != StreamSerializer::SEGMENTTYPE_EMPTYBLOCK_32BIT
+                            || this->currentSegmentDataLeft < bytesCount) {
+                        return blockCount;
+                    }
+                    const std::size_t segmentBlockCount = this->currentSegmentDataLeft / bytesCount;
+                    this->currentSegmentDataLeft -= segmentBlockCount * bytesCount;
+                    blockCount += segmentBlockCount;
+                }
+            }
+
+
             /**
              * Read a 32 bit integer from a byte array.
              * @param n Integer.
@@ -253,6 +345,10 @@ namespace serialize {
                         readIntFromByteBuffer(this->currentSegmentDataLeft, buf);
                         break;
 
+                    case StreamSerializer::SEGMENTTYPE_RUNS_32BIT:
+                        this->readRuns();
+                        break;
+
                     case StreamSerializer::SEGMENTTYPE_END:
                         break;
 
@@ -263,6 +359,53 @@ namespace serialize {
             }
 
 
+            /**
+             * Read the length and runs of a runs segment, checking that the runs are in increasing order,
+             * separated by 'OFF' bits and within the segment.
+             */
+            void readRuns() {
+                byte buf[4];
+                std::size_t runCount = 0;
+                this->readFromInput(buf, 4);
+                readIntFromByteBuffer(this->currentSegmentSize, buf);
+                this->readFromInput(buf, 4);
+                readIntFromByteBuffer(runCount, buf);
+                this->currentSegmentDataLeft = this->currentSegmentSize;
+                this->currentRuns.clear();
+                std::size_t minIndex = 0;
+                for (std::size_t i = 0; i < 2 * runCount && !this->failed(); ++i) {
+                    this->readFromInput(buf, 2);
+                    const unsigned short index = buf[0] | (buf[1] << 8);
+                    if (index < minIndex || index >= this->currentSegmentSize * 8) {
+                        this->fail = true;
+                        this->currentSegmentType = StreamSerializer::SEGMENTTYPE_END;
+                        return;
+                    }
+                    this->currentRuns.push_back(index);
+                    minIndex = i % 2 == 0 ? index : index + 2;
+                }
+            }
+
+
+            /**
+             * Write the bits of the current runs segment to a byte buffer.
+             * @param data Data buffer.
+             * @param bytesCount Number of bytes to write, starting at the current position in the segment.
+             */
+            void expandRuns(byte* data, std::size_t bytesCount) {
+                const std::size_t begin = (this->currentSegmentSize - this->currentSegmentDataLeft) * 8;
+                const std::size_t end = begin + bytesCount * 8;
+                std::memset(data, 0, bytesCount);
+                for (std::size_t i = 0; i < this->currentRuns.size(); i += 2) {
+                    const std::size_t first = std::max(begin, (std::size_t)this->currentRuns[i]);
+                    const std::size_t last = std::min(end, (std::size_t)this->currentRuns[i + 1] + 1);
+                    if (first < last) {
+                        util::setBitsInRange(data, first - begin, last - begin, true);
+                    }
+                }
+            }
+
+
             /**
              * Read data from input.
              * @param buf Data buffer pointer.
@@ -280,6 +423,8 @@ namespace serialize {
             bool inverted;
             byte currentSegmentType;
             std::size_t currentSegmentDataLeft;
+            std::size_t currentSegmentSize; // Total length of a runs segment.
+            std::vector<unsigned short> currentRuns;
     };
     
 
@@ -895,3 +895,1632 @@ TEST_CASE("bitvector/get_next", "[bitvector]") {
 }
 
 
+
+
+template <typename BitVectorA, typename BitVectorB>
+static void fillPseudoRandom(BitVectorA& bva, BitVectorB& bvb, unsigned int seed, std::size_t length, int density) {
+    for (std::size_t i = 0; i < length; ++i) {
+        seed = seed * 1103515245 + 12345;
+        if ((int)((seed >> 16) % 100) < density) {
+            bva.set(i, true);
+            bvb.set(i, true);
+        }
+    }
+}
+
+
+template <typename BitBlock>
+static void checkBitOpsAgainstDefault() {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1024> > DefaultBitVector;
+    typedef bitlib2::BitVector<BitBlock> BitVector;
+
+    for (int inversion = 0; inversion < 4; ++inversion) {
+        DefaultBitVector d1, d2;
+        BitVector b1, b2;
+        fillPseudoRandom(d1, b1, 1, 1024 * 5 + 17, 50);
+        fillPseudoRandom(d2, b2, 2, 1024 * 3 + 99, 30);
+        if (inversion & 1) {
+            d1.invert();
+            b1.invert();
+        }
+        if (inversion & 2) {
+            d2.invert();
+            b2.invert();
+        }
+
+        DefaultBitVector dr;
+        BitVector br;
+
+        dr = d1; dr.bitAnd(d2);
+        br = b1; br.bitAnd(b2);
+        REQUIRE(br == dr); // Bitwise and equals the default implementation.
+
+        dr = d1; dr.bitAndInv(d2);
+        br = b1; br.bitAndInv(b2);
+        REQUIRE(br == dr); // Bitwise and inverse equals the default implementation.
+
+        dr = d1; dr.bitOr(d2);
+        br = b1; br.bitOr(b2);
+        REQUIRE(br == dr); // Bitwise or equals the default implementation.
+
+        dr = d1; dr.bitOrInv(d2);
+        br = b1; br.bitOrInv(b2);
+        REQUIRE(br == dr); // Bitwise or inverse equals the default implementation.
+
+        dr = d1; dr.bitXor(d2);
+        br = b1; br.bitXor(b2);
+        REQUIRE(br == dr); // Bitwise xor equals the default implementation.
+    }
+}
+
+
+TEST_CASE("bitvector/simd_bitop", "[bitvector]") {
+    checkBitOpsAgainstDefault<bitlib2::BitBlock<1024, bitlib2::StdAllocatorSelector, bitlib2::operation::SimdBitOp<128> > >();
+    checkBitOpsAgainstDefault<bitlib2::BitBlock<1024, bitlib2::StdAllocatorSelector, bitlib2::operation::SimdBitOp<256> > >();
+    checkBitOpsAgainstDefault<bitlib2::BitBlock<1024, bitlib2::StdAllocatorSelector, bitlib2::operation::SimdBitOp<512> > >();
+    checkBitOpsAgainstDefault<bitlib2::BitBlock<65536, bitlib2::StdAllocatorSelector, bitlib2::operation::SimdBitOp<256> > >();
+
+    typedef bitlib2::BitBlock<100, bitlib2::StdAllocatorSelector, bitlib2::operation::SimdBitOp<512> > BitBlock512;
+    REQUIRE(BitBlock512::BlockByteCount == 64); // Block size is rounded up to the SIMD operand size.
+}
+
+
+template <typename BitBlock>
+static void checkFusedCounts() {
+    typedef bitlib2::BitVector<BitBlock> BitVector;
+
+    for (int inversion = 0; inversion < 4; ++inversion) {
+        BitVector bv1, bv2;
+        fillPseudoRandom(bv1, bv1, 3, 1024 * 4 + 5, 40);
+        fillPseudoRandom(bv2, bv2, 4, 1024 * 6 + 77, 20);
+        if (inversion & 1) {
+            bv1.invert();
+        }
+        if (inversion & 2) {
+            bv2.invert();
+        }
+
+        for (int otherInverted = 0; otherInverted < 2; ++otherInverted) {
+            BitVector expected, fused;
+
+            expected = bv1; expected.bitAnd(bv2, otherInverted);
+            fused = bv1;
+            REQUIRE(fused.bitAndCount(bv2, otherInverted) == expected.count()); // Fused and-count equals count after bitwise and.
+            REQUIRE(fused == expected); // Fused and-count has the same result as bitwise and.
+
+            expected = bv1; expected.bitOr(bv2, otherInverted);
+            fused = bv1;
+            REQUIRE(fused.bitOrCount(bv2, otherInverted) == expected.count()); // Fused or-count equals count after bitwise or.
+            REQUIRE(fused == expected); // Fused or-count has the same result as bitwise or.
+
+            expected = bv1; expected.bitXor(bv2, otherInverted);
+            fused = bv1;
+            REQUIRE(fused.bitXorCount(bv2, otherInverted) == expected.count()); // Fused xor-count equals count after bitwise xor.
+            REQUIRE(fused == expected); // Fused xor-count has the same result as bitwise xor.
+        }
+    }
+}
+
+
+TEST_CASE("bitvector/bitwise_count", "[bitvector]") {
+    checkFusedCounts<bitlib2::BitBlock<1024> >();
+    checkFusedCounts<bitlib2::BitBlock<1024, bitlib2::StdAllocatorSelector, bitlib2::operation::DefaultBitOp<8> > >();
+    checkFusedCounts<bitlib2::BitBlock<1024, bitlib2::StdAllocatorSelector, bitlib2::operation::SimdBitOp<128> > >();
+    checkFusedCounts<bitlib2::BitBlock<1024, bitlib2::StdAllocatorSelector, bitlib2::operation::SimdBitOp<256> > >();
+    checkFusedCounts<bitlib2::BitBlock<1024, bitlib2::StdAllocatorSelector, bitlib2::operation::SimdBitOp<512> > >();
+    checkFusedCounts<bitlib2::BitBlock<20000, bitlib2::StdAllocatorSelector, bitlib2::operation::SimdBitOp<256> > >();
+}
+
+
+static std::size_t testAllocationCount = 0;
+static std::size_t testDeallocationCount = 0;
+
+
+template <typename T>
+struct CountingAllocator : public std::allocator<T> {
+    template <typename U> struct rebind {
+        typedef CountingAllocator<U> other;
+    };
+
+    CountingAllocator() {}
+    template <typename U> CountingAllocator(const CountingAllocator<U>&) {}
+
+    T* allocate(std::size_t n, const void* = 0) {
+        testAllocationCount += 1;
+        return std::allocator<T>::allocate(n);
+    }
+
+    void deallocate(T* p, std::size_t n) {
+        testDeallocationCount += 1;
+        std::allocator<T>::deallocate(p, n);
+    }
+};
+
+
+struct CountingAllocatorSelector
+{
+    template <typename _BitBlock> struct BitBlockContainerAllocator {
+        typedef CountingAllocator<_BitBlock> type;
+    };
+    template <typename _Block> struct BitBlockDataAllocator {
+        typedef CountingAllocator<_Block> type;
+    };
+    template <typename _RefCounter> struct RefCounterAllocator {
+        typedef CountingAllocator<_RefCounter> type;
+    };
+};
+
+
+template <typename BitBlock>
+static void checkNonMaterializingCounts() {
+    typedef bitlib2::BitVector<BitBlock> BitVector;
+    const typename BitVector::IndexType INF = BitVector::INFINITE;
+
+    for (int inversion = 0; inversion < 4; ++inversion) {
+        BitVector bv1, bv2;
+        fillPseudoRandom(bv1, bv1, 5, 1024 * 5 + 3, 30);
+        fillPseudoRandom(bv2, bv2, 6, 1024 * 2 + 700, 60);
+        bv1.set(1024 * 9 + 1, true);
+        if (inversion & 1) {
+            bv1.invert();
+        }
+        if (inversion & 2) {
+            bv2.invert();
+        }
+
+        BitVector expected;
+        expected = bv1; expected.bitAnd(bv2);
+        REQUIRE(bv1.andCount(bv2) == expected.count()); // And-count equals count after bitwise and.
+        REQUIRE(bv2.andCount(bv1) == expected.count()); // And-count is symmetric.
+
+        expected = bv1; expected.bitOr(bv2);
+        REQUIRE(bv1.orCount(bv2) == expected.count()); // Or-count equals count after bitwise or.
+
+        expected = bv1; expected.bitXor(bv2);
+        REQUIRE(bv1.xorCount(bv2) == expected.count()); // Xor-count equals count after bitwise xor.
+
+        expected = bv1; expected.bitAndInv(bv2);
+        REQUIRE(bv1.andNotCount(bv2) == expected.count()); // And-not-count equals count after bitwise and inverse.
+    }
+
+    BitVector bv1, bv2;
+    bv1.invert();
+    REQUIRE(bv1.orCount(bv2) == INF); // Or-count with inverted bitvector is infinite.
+}
+
+
+TEST_CASE("bitvector/non_materializing_count", "[bitvector]") {
+    checkNonMaterializingCounts<bitlib2::BitBlock<1024> >();
+    checkNonMaterializingCounts<bitlib2::BitBlock<1024, bitlib2::StdAllocatorSelector, bitlib2::operation::SimdBitOp<128> > >();
+    checkNonMaterializingCounts<bitlib2::BitBlock<1024, bitlib2::StdAllocatorSelector, bitlib2::operation::SimdBitOp<256> > >();
+    checkNonMaterializingCounts<bitlib2::BitBlock<1024, bitlib2::StdAllocatorSelector, bitlib2::operation::SimdBitOp<512> > >();
+
+    // Counting does not allocate:
+    {
+        typedef bitlib2::BitVector<bitlib2::BitBlock<1024, CountingAllocatorSelector> > BitVector;
+        BitVector bv1, bv2;
+        fillPseudoRandom(bv1, bv2, 7, 1024 * 4, 50);
+        bv2.set(1024 * 7, true);
+        const BitVector bv3(bv1);
+
+        const std::size_t allocationCount = testAllocationCount;
+        bv1.andCount(bv2);
+        bv1.orCount(bv2);
+        bv1.xorCount(bv2);
+        bv1.andNotCount(bv2);
+        bv3.andCount(bv1);
+        REQUIRE(testAllocationCount == allocationCount); // No memory is allocated.
+    }
+}
+
+
+TEST_CASE("bitvector/get_prev", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<768> > BitVector;
+    const BitVector::IndexType INF = BitVector::INFINITE;
+
+    // Empty bitvector:
+    {
+        BitVector bv1;
+        REQUIRE(bv1.getPrev(12345, true) == INF);
+        REQUIRE(bv1.getPrev(12345, false) == 12345);
+        REQUIRE(bv1.last() == INF);
+    }
+
+    // Inverted empty bitvector:
+    {
+        BitVector bv1;
+        bv1.invert();
+        REQUIRE(bv1.getPrev(12345, false) == INF);
+        REQUIRE(bv1.getPrev(12345, true) == 12345);
+        REQUIRE(bv1.last() == INF); // Inverted bitvector has infinitely many 'ON' bits.
+    }
+
+    // Bitvector with various bits set in multiple blocks, with block gaps in between:
+    {
+        BitVector bv1;
+        const BitVector::IndexType indexes[] = {
+            1234567, 1048576, 65535, 32766, 23456, 12345, 4567, 123, 7, 2, 1, 0,
+            BitVector::INFINITE
+        };
+        int i = 0;
+        BitVector::IndexType index;
+        while ((index = indexes[i++]) != BitVector::INFINITE) {
+            bv1.set(index, true);
+        }
+        const int indexCount = i;
+
+        REQUIRE(bv1.last() == 1234567); // Highest 'ON' bit.
+
+        i = 0;
+        index = bv1.getPrev(INF, true);
+        REQUIRE(index == indexes[i++]);
+        while (index != 0) {
+            index = bv1.getPrev(index - 1, true);
+            REQUIRE(index == indexes[i++]);
+        }
+        REQUIRE(i == indexCount - 1);
+
+        REQUIRE(bv1.getPrev(3, false) == 3);
+        REQUIRE(bv1.getPrev(2, false) == INF);
+        REQUIRE(bv1.getPrev(23456, false) == 23455);
+        REQUIRE(bv1.getPrev(23457, true) == 23456);
+        REQUIRE(bv1.getPrev(23455, true) == 12345);
+        REQUIRE(bv1.getPrev(2000000, false) == 2000000);
+
+        bv1.invert();
+
+        REQUIRE(bv1.getPrev(3, true) == 3);
+        REQUIRE(bv1.getPrev(2, true) == INF);
+        REQUIRE(bv1.getPrev(23455, false) == 12345);
+        REQUIRE(bv1.getPrev(2000000, false) == 1234567);
+    }
+}
+
+
+TEST_CASE("bitvector/count_cache", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<512> > BitVector;
+    BitVector bv1;
+    std::vector<bool> reference(512 * 10, false);
+    std::size_t expectedCount = 0;
+
+    unsigned int seed = 42;
+    for (int i = 0; i < 5000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        const std::size_t index = (seed >> 8) % reference.size();
+        const bool value = (seed >> 4) % 3 != 0;
+        if (reference[index] != value) {
+            expectedCount += value ? 1 : -1;
+            reference[index] = value;
+        }
+        bv1.set(index, value);
+        if (i % 100 == 0) {
+            REQUIRE(bv1.count() == expectedCount); // Cached count follows set operations.
+        }
+    }
+    REQUIRE(bv1.count() == expectedCount); // Cached count follows set operations.
+
+    BitVector bv2(bv1);
+    bv2.set(0, !reference[0]);
+    REQUIRE(bv1.count() == expectedCount); // Changing a copy does not change the count of the original.
+    REQUIRE(bv2.count() == expectedCount + (reference[0] ? -1 : 1)); // Copy keeps its own count.
+
+    BitVector bv3;
+    bv3.set(1, true).set(512 * 3 + 7, true).set(512 * 12, true);
+    bv2 = bv1;
+    bv2.bitOr(bv3);
+    REQUIRE(bv2.count() == bv2.count(512 * 13)); // Count after bitwise or is recomputed.
+    bv2.bitAnd(bv3);
+    REQUIRE(bv2.count() == 3); // Count after bitwise and is recomputed.
+    bv2.set(512 * 12, false);
+    REQUIRE(bv2.count() == 2); // Cached count is updated after clearing a bit.
+}
+
+
+TEST_CASE("bitvector/rank", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000> > BitVector;
+    BitVector bv1, bv2;
+    fillPseudoRandom(bv1, bv2, 3, 1024 * 3 + 11, 40);
+    bv1.set(1024 * 7 + 5, true);
+    bv2.set(1024 * 7 + 5, true);
+
+    REQUIRE(bv1.rank(0) == 0); // Nothing before the first bit.
+    bool allMatch = true;
+    for (std::size_t i = 1; i < 1024 * 9; ++i) {
+        allMatch = allMatch && bv1.rank(i) == bv2.count(i);
+    }
+    REQUIRE(allMatch); // Rank matches prefix count.
+    REQUIRE(bv1.rank(1000000) == bv1.count()); // Rank beyond the last block is the total count.
+
+    bv1.set(3, !bv1.get(3));
+    REQUIRE(bv1.rank(1024 * 4) == bv1.count(1024 * 4)); // Rank follows a set operation.
+    bv1.bitAnd(bv2);
+    REQUIRE(bv1.rank(1024 * 4) == bv2.count(1024 * 4) - (bv2.get(3) ? 1 : 0)); // Rank follows a bitwise operation.
+    bv1.invert();
+    REQUIRE(bv1.rank(1024 * 4) == bv1.count(1024 * 4)); // Rank respects the inverted flag.
+    REQUIRE(bv1.rank(1024 * 20) == 1024 * 20 - bv2.count() + (bv2.get(3) ? 1 : 0)); // Inverted rank beyond the last block.
+    bv1.clear();
+    REQUIRE(bv1.rank(1024 * 4) == 0); // Rank of a cleared bitvector.
+}
+
+
+TEST_CASE("bitvector/select", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000> > BitVector;
+    const BitVector::IndexType INF = BitVector::INFINITE;
+    BitVector bv1, bv2;
+    fillPseudoRandom(bv1, bv2, 4, 1024 * 3 + 11, 30);
+    bv1.set(1024 * 7 + 5, true);
+    const std::size_t onCount = bv1.count();
+
+    REQUIRE(bv1.select(0) == bv1.getNext(0)); // First 'ON' bit.
+    bool allMatch = true;
+    std::size_t rank = 0;
+    for (std::size_t i = bv1.getNext(0); i != INF; i = bv1.getNext(i + 1), ++rank) {
+        allMatch = allMatch && bv1.select(rank) == i && bv1.rank(i) == rank;
+    }
+    REQUIRE(allMatch); // Select finds every 'ON' bit and is the inverse of rank.
+    REQUIRE(rank == onCount);
+    REQUIRE(bv1.select(onCount) == INF); // No more 'ON' bits.
+    REQUIRE(bv1.select(onCount + 1000) == INF); // No more 'ON' bits.
+
+    bv1.set(1024 * 7 + 5, false);
+    REQUIRE(bv1.select(onCount - 1) == INF); // Select follows a set operation.
+
+    bv1.invert();
+    allMatch = true;
+    rank = 0;
+    for (std::size_t i = bv1.getNext(0); i < 1024 * 9; i = bv1.getNext(i + 1), ++rank) {
+        allMatch = allMatch && bv1.select(rank) == i;
+    }
+    REQUIRE(allMatch); // Select respects the inverted flag.
+    REQUIRE(bv1.select(rank + 5) == 1024 * 9 + 5); // Inverted select beyond the last block.
+
+    BitVector bv3;
+    REQUIRE(bv3.select(0) == INF); // Empty bitvector.
+    bv3.set(5000, true);
+    bv3.set(5003, true);
+    REQUIRE(bv3.select(1) == 5003); // Select skips null blocks.
+}
+
+
+TEST_CASE("bitvector/set_many", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000> > BitVector;
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000, bitlib2::StdAllocatorSelector, bitlib2::operation::DefaultBitOp<8> > > ByteBitVector;
+
+    std::vector<BitVector::IndexType> indexes;
+    unsigned int seed = 7;
+    for (int i = 0; i < 3000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        indexes.push_back((seed >> 8) % (1024 * 6));
+    }
+    std::vector<BitVector::IndexType> sortedIndexes(indexes);
+    std::sort(sortedIndexes.begin(), sortedIndexes.end());
+
+    for (int inversion = 0; inversion < 2; ++inversion) {
+        for (int value = 0; value < 2; ++value) {
+            BitVector expected, bv1, bv2;
+            ByteBitVector bv3;
+            fillPseudoRandom(expected, bv1, 8, 1024 * 3, 50);
+            fillPseudoRandom(bv2, bv3, 8, 1024 * 3, 50);
+            if (inversion) {
+                expected.invert();
+                bv1.invert();
+                bv2.invert();
+                bv3.invert();
+            }
+            const BitVector copy(bv1);
+            for (std::size_t i = 0; i < indexes.size(); ++i) {
+                expected.set(indexes[i], value);
+            }
+            bv1.setMany(&sortedIndexes[0], &sortedIndexes[0] + sortedIndexes.size(), value);
+            bv2.setMany(&indexes[0], &indexes[0] + indexes.size(), value);
+            bv3.setMany(&sortedIndexes[0], &sortedIndexes[0] + sortedIndexes.size(), value);
+            REQUIRE(bv1 == expected); // Sorted indexes.
+            REQUIRE(bv2 == expected); // Unsorted indexes.
+            REQUIRE(bv3 == expected); // Block size not a multiple of the word size.
+            REQUIRE(bv1.count(1024 * 7) == expected.count(1024 * 7)); // Count is kept up to date.
+            REQUIRE(bv1.rank(1024 * 7) == expected.count(1024 * 7)); // Rank is kept up to date.
+            REQUIRE(copy != bv1); // Shared data is copied before writing.
+        }
+    }
+
+    BitVector bv4;
+    bv4.setMany(&indexes[0], &indexes[0], true);
+    REQUIRE(bv4.count() == 0); // Empty index range.
+
+    // Few indexes per block, merged into position arrays and run containers:
+    for (int value = 0; value < 2; ++value) {
+        BitVector expected, bv5;
+        expected.setRange(100, 900, true).set(1500, true).set(1600, true);
+        bv5 = expected;
+        for (std::size_t i = 0; i < 60; ++i) {
+            expected.set(indexes[i] / 3, value);
+        }
+        std::vector<BitVector::IndexType> fewIndexes;
+        for (std::size_t i = 0; i < 60; ++i) {
+            fewIndexes.push_back(indexes[i] / 3);
+        }
+        std::sort(fewIndexes.begin(), fewIndexes.end());
+        bv5.setMany(&fewIndexes[0], &fewIndexes[0] + fewIndexes.size(), value);
+        REQUIRE(bv5 == expected);
+        REQUIRE(bv5.count() == expected.count());
+    }
+}
+
+
+TEST_CASE("bitvector/get_many", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000> > BitVector;
+    BitVector bv1, bv2;
+    fillPseudoRandom(bv1, bv2, 9, 1024 * 4, 40);
+    bv1.set(1024 * 6 + 1, true);
+
+    std::vector<BitVector::IndexType> indexes;
+    unsigned int seed = 11;
+    for (int i = 0; i < 2000; ++i) {
+        seed = seed * 1103515245 + 12345;
+        indexes.push_back((seed >> 8) % (1024 * 9));
+    }
+    std::vector<BitVector::IndexType> sortedIndexes(indexes);
+    std::sort(sortedIndexes.begin(), sortedIndexes.end());
+
+    for (int inversion = 0; inversion < 2; ++inversion) {
+        for (int sorted = 0; sorted < 2; ++sorted) {
+            const std::vector<BitVector::IndexType>& probes = sorted ? sortedIndexes : indexes;
+            bool values[2000];
+            bitlib2::byte mask[250];
+            bv1.getMany(&probes[0], probes.size(), values);
+            bv1.getManyPacked(&probes[0], probes.size(), mask);
+            bool allMatch = true;
+            for (std::size_t i = 0; i < probes.size(); ++i) {
+                const bool expected = bv1.get(probes[i]);
+                allMatch = allMatch && values[i] == expected && (((mask[i / 8] >> (i % 8)) & 1) != 0) == expected;
+            }
+            REQUIRE(allMatch); // Batch lookup matches single lookups.
+        }
+        bv1.invert();
+    }
+
+    bitlib2::byte mask[1] = {0xFF};
+    bv1.getManyPacked(&indexes[0], 3, mask);
+    REQUIRE((mask[0] >> 3) == 0); // Unused mask bits are cleared.
+}
+
+
+template <typename BitVector, typename T>
+static void checkToArray(BitVector& bv, std::size_t pageSize) {
+    std::vector<T> expected;
+    for (std::size_t i = bv.getNext(0); expected.size() < 5000 && i != BitVector::INFINITE; i = bv.getNext(i + 1)) {
+        expected.push_back((T)i);
+    }
+
+    std::vector<T> values;
+    std::vector<T> page(pageSize);
+    std::size_t startIndex = 0;
+    while (values.size() < expected.size()) {
+        const std::size_t count = bv.toArray(&page[0], pageSize, startIndex);
+        if (count == 0) {
+            break;
+        }
+        values.insert(values.end(), page.begin(), page.begin() + count);
+        startIndex = page[count - 1] + 1;
+    }
+    values.resize(std::min(values.size(), expected.size()));
+    REQUIRE(values == expected); // Paged extraction matches a getNext scan.
+}
+
+
+TEST_CASE("bitvector/to_array", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000> > BitVector;
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000, bitlib2::StdAllocatorSelector, bitlib2::operation::DefaultBitOp<8> > > ByteBitVector;
+    BitVector bv1;
+    ByteBitVector bv2;
+    fillPseudoRandom(bv1, bv2, 12, 1024 * 3 + 5, 20);
+    bv1.set(1024 * 8 + 3, true);
+    bv2.set(1000 * 8 + 3, true);
+
+    for (int inversion = 0; inversion < 2; ++inversion) {
+        checkToArray<BitVector, unsigned int>(bv1, 1);
+        checkToArray<BitVector, unsigned int>(bv1, 37);
+        checkToArray<BitVector, unsigned long long>(bv1, 1000);
+        checkToArray<ByteBitVector, unsigned int>(bv2, 37);
+        checkToArray<ByteBitVector, std::size_t>(bv2, 64);
+        bv1.invert();
+        bv2.invert();
+    }
+
+    BitVector bv3;
+    unsigned int values[4];
+    REQUIRE(bv3.toArray(values, 4) == 0); // Empty bitvector.
+    bv3.set(70000, true);
+    REQUIRE(bv3.toArray(values, 4) == 1); // Skips empty blocks.
+    REQUIRE(values[0] == 70000);
+    REQUIRE(bv3.toArray(values, 4, 70001) == 0); // Nothing after the last bit.
+    REQUIRE(bv3.toArray(values, 0) == 0); // No capacity.
+}
+
+
+TEST_CASE("bitvector/const_iterator", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000> > BitVector;
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000, bitlib2::StdAllocatorSelector, bitlib2::operation::DefaultBitOp<8> > > ByteBitVector;
+    BitVector bv1;
+    ByteBitVector bv2;
+    fillPseudoRandom(bv1, bv2, 13, 1024 * 3 + 5, 20);
+    bv1.set(1024 * 8 + 63, true);
+    bv2.set(1000 * 8 + 63, true);
+
+    std::vector<std::size_t> expected;
+    for (std::size_t i = bv1.getNext(0); i != BitVector::INFINITE; i = bv1.getNext(i + 1)) {
+        expected.push_back(i);
+    }
+    std::vector<std::size_t> values(bv1.begin(), bv1.end());
+    REQUIRE(values == expected); // Iterates all 'ON' bits.
+
+    values.clear();
+    for (ByteBitVector::const_iterator it = bv2.begin(); it != bv2.end(); ++it) {
+        values.push_back(*it);
+    }
+    REQUIRE(values.size() == bv2.count()); // Block size not a multiple of the word size.
+    REQUIRE(values.back() == 1000 * 8 + 63);
+
+    values.clear();
+    BitVector::ConstRange range = bv1.range(1000, 2100);
+    for (BitVector::const_iterator it = range.begin(); it != range.end(); it++) {
+        values.push_back(*it);
+    }
+    REQUIRE(values.size() == bv1.count(2100) - bv1.count(1000)); // Bounded range.
+    REQUIRE(values.front() == bv1.getNext(1000));
+
+    bv1.invert();
+    values.clear();
+    range = bv1.range(1024 * 8 + 60, 1024 * 8 + 70);
+    for (BitVector::const_iterator it = range.begin(); it != range.end(); ++it) {
+        values.push_back(*it);
+    }
+    REQUIRE(values.size() == 9); // Inverted bounded range.
+    REQUIRE(values[3] == 1024 * 8 + 64);
+    REQUIRE(*bv1.range(1024 * 20).begin() == 1024 * 20); // Inverted range beyond the last block.
+
+    BitVector bv3;
+    REQUIRE(bv3.begin() == bv3.end()); // Empty bitvector.
+    bv3.set(100000, true);
+    REQUIRE(*bv3.begin() == 100000); // Skips empty blocks.
+    REQUIRE(++bv3.begin() == bv3.end());
+    REQUIRE(bv3.range(100001).begin() == bv3.end());
+}
+
+
+struct CollectingVisitor {
+    CollectingVisitor(std::vector<std::size_t>& indexes, std::size_t limit) : indexes(indexes), limit(limit) {}
+    bool operator()(std::size_t index) {
+        indexes.push_back(index);
+        return indexes.size() < limit;
+    }
+    std::vector<std::size_t>& indexes;
+    std::size_t limit;
+};
+
+
+struct WordCollectingVisitor {
+    WordCollectingVisitor(std::vector<std::size_t>& wordStarts, std::vector<std::size_t>& indexes) : wordStarts(wordStarts), indexes(indexes) {}
+    bool operator()(std::size_t wordStart, unsigned long long word) {
+        wordStarts.push_back(wordStart);
+        for (; word; word &= word - 1) {
+            indexes.push_back(wordStart + __builtin_ctzll(word));
+        }
+        return true;
+    }
+    std::vector<std::size_t>& wordStarts;
+    std::vector<std::size_t>& indexes;
+};
+
+
+static bool isBelowThousand(std::size_t index) {
+    return index < 1000;
+}
+
+
+TEST_CASE("bitvector/for_each_set_bit", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000> > BitVector;
+    BitVector bv1, bv2;
+    fillPseudoRandom(bv1, bv2, 14, 1024 * 3 + 5, 20);
+    bv1.set(1024 * 8 + 63, true);
+
+    const std::vector<std::size_t> expected(bv1.begin(), bv1.end());
+    {
+        std::vector<std::size_t> indexes;
+        REQUIRE(bv1.forEachSetBit(CollectingVisitor(indexes, expected.size() + 1))); // Not stopped.
+        REQUIRE(indexes == expected); // Visits all 'ON' bits.
+    }
+    {
+        std::vector<std::size_t> indexes;
+        REQUIRE(!bv1.forEachSetBit(CollectingVisitor(indexes, 10))); // Stopped by the visitor.
+        REQUIRE(indexes == std::vector<std::size_t>(expected.begin(), expected.begin() + 10)); // Early termination.
+    }
+    {
+        std::vector<std::size_t> indexes;
+        bv1.forEachSetBitInRange(1000, 2100, CollectingVisitor(indexes, 100000));
+        const BitVector::ConstRange range = bv1.range(1000, 2100);
+        REQUIRE(indexes == std::vector<std::size_t>(range.begin(), range.end())); // Range.
+    }
+    {
+        std::vector<std::size_t> wordStarts, indexes;
+        bv1.forEachSetWordInRange(1001, 1024 * 8 + 63, WordCollectingVisitor(wordStarts, indexes));
+        const BitVector::ConstRange range = bv1.range(1001, 1024 * 8 + 63);
+        REQUIRE(indexes == std::vector<std::size_t>(range.begin(), range.end())); // Words, masked to the range.
+        REQUIRE(wordStarts.front() == 960); // Words are aligned.
+    }
+    {
+        const bool completed = bv1.forEachSetBit(isBelowThousand); // Plain functions are visitors as well.
+        REQUIRE(!completed);
+    }
+
+    bv1.invert();
+    {
+        std::vector<std::size_t> indexes, limitedIndexes;
+        bv1.forEachSetBitInRange(1024 * 8 + 60, 1024 * 20 + 2, CollectingVisitor(indexes, 100000));
+        REQUIRE(indexes.size() == 1024 * 12 + 2 - 60 - 1); // Inverted range beyond the last block.
+        REQUIRE(indexes[3] == 1024 * 8 + 64);
+        REQUIRE(!bv1.forEachSetBit(CollectingVisitor(limitedIndexes, 5))); // Unbounded inverted visit stopped by the visitor.
+    }
+    {
+        std::vector<std::size_t> wordStarts, indexes;
+        BitVector bv3;
+        bv3.set(100000, true);
+        bv3.forEachSetWord(WordCollectingVisitor(wordStarts, indexes));
+        REQUIRE(wordStarts.size() == 1); // Skips empty blocks and words.
+        REQUIRE(indexes[0] == 100000);
+    }
+}
+
+
+TEST_CASE("bitvector/set_range", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000> > BitVector;
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000, bitlib2::StdAllocatorSelector, bitlib2::operation::DefaultBitOp<8> > > ByteBitVector;
+
+    const std::size_t ranges[][3] = {
+        {5, 6, 1}, {7, 7, 1}, {10, 1500, 1}, {1024, 2048, 0}, {3, 9000, 1}, {1030, 1035, 0},
+        {2048, 5120, 0}, {100, 10000, 0}, {4000, 12000, 1}, {4001, 8000, 0}, {20000, 20001, 0}
+    };
+    for (int inversion = 0; inversion < 2; ++inversion) {
+        BitVector expected, bv1;
+        ByteBitVector bv2;
+        fillPseudoRandom(expected, bv1, 15, 1024 * 3, 50);
+        fillPseudoRandom(bv2, bv2, 15, 1024 * 3, 50);
+        if (inversion) {
+            expected.invert();
+            bv1.invert();
+            bv2.invert();
+        }
+        for (std::size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); ++r) {
+            for (std::size_t i = ranges[r][0]; i < ranges[r][1]; ++i) {
+                expected.set(i, ranges[r][2] != 0);
+            }
+            bv1.setRange(ranges[r][0], ranges[r][1], ranges[r][2] != 0);
+            bv2.setRange(ranges[r][0], ranges[r][1], ranges[r][2] != 0);
+            REQUIRE(bv1 == expected); // Matches setting bit by bit.
+            REQUIRE(bv2 == expected); // Block size not a multiple of the word size.
+            REQUIRE(bv1.count(30000) == expected.count(30000)); // Count is up to date.
+        }
+    }
+
+    // Filled blocks share static data:
+    {
+        typedef bitlib2::BitVector<bitlib2::BitBlock<1024, CountingAllocatorSelector> > CountingBitVector;
+        CountingBitVector bv3;
+        bv3.setRange(0, 1024 * 40, false);
+        bv3.set(1024 * 40, true);
+        const std::size_t allocationCount = testAllocationCount;
+        bv3.setRange(0, 1024 * 40, true);
+        REQUIRE(testAllocationCount == allocationCount); // No block data is allocated.
+        REQUIRE(bv3.count() == 1024 * 40 + 1);
+        CountingBitVector bv4(bv3);
+        const std::size_t copyAllocationCount = testAllocationCount;
+        bv4.set(5, false);
+        REQUIRE(testAllocationCount == copyAllocationCount + 1); // Writing copies the data.
+        REQUIRE(bv4.count() == 1024 * 40);
+        REQUIRE(bv3.count() == 1024 * 40 + 1); // Other filled blocks are unchanged.
+        REQUIRE(bv3.get(5));
+        bv3.setRange(0, 1024 * 40, false);
+        REQUIRE(bv3.count() == 1);
+    }
+}
+
+
+TEST_CASE("bitvector/count_range", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000> > BitVector;
+    BitVector bv1, bv2;
+    fillPseudoRandom(bv1, bv2, 16, 1024 * 4 + 9, 35);
+    bv1.setRange(1024 * 5, 1024 * 6, true);
+    bv2.setRange(1024 * 5, 1024 * 6, true);
+
+    const std::size_t bounds[] = {0, 1, 63, 64, 65, 1000, 1023, 1024, 1025, 3000, 1024 * 5, 1024 * 6 + 7, 1024 * 9};
+    const std::size_t boundCount = sizeof(bounds) / sizeof(bounds[0]);
+    for (int inversion = 0; inversion < 2; ++inversion) {
+        for (int withRank = 0; withRank < 2; ++withRank) {
+            if (withRank) {
+                bv1.rank(0); // Builds the rank directory.
+            }
+            bool allMatch = true;
+            for (std::size_t b = 0; b < boundCount; ++b) {
+                for (std::size_t e = 0; e < boundCount; ++e) {
+                    const std::size_t begin = bounds[b];
+                    const std::size_t end = bounds[e];
+                    const std::size_t expected = begin >= end ? 0 : bv2.count(end) - (begin == 0 ? 0 : bv2.count(begin));
+                    allMatch = allMatch && bv1.count(begin, end) == expected;
+                }
+            }
+            REQUIRE(allMatch); // Range count matches the difference of prefix counts.
+            bv1.set(3, bv1.get(3)); // Invalidates the rank directory.
+        }
+        bv1.invert();
+        bv2.invert();
+    }
+}
+
+
+template <typename BitVector>
+static void checkShifts(std::size_t shift) {
+    for (int inversion = 0; inversion < 2; ++inversion) {
+        BitVector bv1, expectedLeft, expectedRight;
+        fillPseudoRandom(bv1, bv1, 17, 1024 * 3 + 21, 40);
+        bv1.setRange(1024 * 4, 1024 * 6, true);
+        if (inversion) {
+            bv1.invert();
+            expectedLeft.invert();
+            expectedRight.invert();
+        }
+        for (std::size_t i = 0; i < 1024 * 8; ++i) {
+            expectedLeft.set(i + shift, bv1.get(i));
+            if (i >= shift) {
+                expectedRight.set(i - shift, bv1.get(i));
+            }
+        }
+        for (std::size_t i = 0; i < shift; ++i) {
+            expectedLeft.set(i, false);
+        }
+
+        BitVector bv2(bv1);
+        bv2.shiftLeft(shift);
+        REQUIRE(bv2 == expectedLeft); // Matches shifting bit by bit.
+        bv2.shiftRight(shift);
+        REQUIRE(bv2 == bv1); // Shifting back restores the original.
+        bv2.shiftRight(shift);
+        REQUIRE(bv2 == expectedRight); // Matches shifting bit by bit.
+        REQUIRE(bv2.count(1024 * 9) == expectedRight.count(1024 * 9));
+    }
+}
+
+
+TEST_CASE("bitvector/shift", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000> > BitVector;
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000, bitlib2::StdAllocatorSelector, bitlib2::operation::DefaultBitOp<8> > > ByteBitVector;
+    const std::size_t shifts[] = {0, 1, 7, 63, 64, 65, 999, 1000, 1023, 1024, 1025, 2048, 3000, 20000};
+    for (std::size_t i = 0; i < sizeof(shifts) / sizeof(shifts[0]); ++i) {
+        checkShifts<BitVector>(shifts[i]);
+        checkShifts<ByteBitVector>(shifts[i]);
+    }
+
+    // Block aligned shifts share the data:
+    {
+        typedef bitlib2::BitVector<bitlib2::BitBlock<1024, CountingAllocatorSelector> > CountingBitVector;
+        CountingBitVector bv3;
+        fillPseudoRandom(bv3, bv3, 18, 1024 * 4, 40);
+        const CountingBitVector bv4(bv3);
+        bv3.shiftLeft(1024 * 3);
+        bv3.shiftRight(1024 * 2);
+        const std::size_t allocationCount = testAllocationCount;
+        bv3.shiftRight(1024);
+        REQUIRE(testAllocationCount == allocationCount); // No memory is allocated.
+        REQUIRE(bv3 == bv4);
+    }
+}
+
+
+TEST_CASE("bitvector/slice", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000> > BitVector;
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000, bitlib2::StdAllocatorSelector, bitlib2::operation::DefaultBitOp<8> > > ByteBitVector;
+    BitVector bv1;
+    ByteBitVector bv2;
+    fillPseudoRandom(bv1, bv2, 19, 1024 * 3 + 21, 40);
+    bv1.setRange(1024 * 4, 1024 * 6, true);
+    bv2.setRange(1024 * 4, 1024 * 6, true);
+
+    const std::size_t ranges[][2] = {
+        {0, 0}, {5, 5}, {0, 1}, {0, 1024}, {1024, 3072}, {1, 1025}, {63, 5000}, {1000, 1003},
+        {3000, 9000}, {1024 * 4, 1024 * 6}, {1024 * 5 + 3, 1024 * 12}, {20000, 20100}
+    };
+    for (int inversion = 0; inversion < 2; ++inversion) {
+        for (std::size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); ++r) {
+            const std::size_t begin = ranges[r][0];
+            const std::size_t end = ranges[r][1];
+            BitVector expected;
+            for (std::size_t i = begin; i < end; ++i) {
+                expected.set(i - begin, bv1.get(i));
+            }
+            const BitVector slice1 = bv1.slice(begin, end);
+            const ByteBitVector slice2 = bv2.slice(begin, end);
+            REQUIRE(slice1 == expected); // Matches copying bit by bit.
+            REQUIRE(slice2 == expected); // Block size not a multiple of the word size.
+            REQUIRE(slice1.count() == expected.count()); // Nothing set beyond the slice.
+        }
+        bv1.invert();
+        bv2.invert();
+    }
+
+    // Block aligned slices share the data:
+    {
+        typedef bitlib2::BitVector<bitlib2::BitBlock<1024, CountingAllocatorSelector> > CountingBitVector;
+        CountingBitVector bv3;
+        fillPseudoRandom(bv3, bv3, 20, 1024 * 8, 40);
+        CountingBitVector slice3;
+        const std::size_t allocationCount = testAllocationCount;
+        slice3 = bv3.slice(1024 * 2, 1024 * 6);
+        const std::size_t sliceAllocationCount = testAllocationCount - allocationCount;
+        REQUIRE(sliceAllocationCount <= 2 + 4); // Only containers and reference counters are allocated.
+        REQUIRE(slice3.count() == bv3.count(1024 * 2, 1024 * 6));
+    }
+}
+
+
+TEST_CASE("bitvector/append", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1000> > BitVector;
+    const std::size_t offsets[] = {0, 1, 63, 1024, 1500, 1024 * 3, 1024 * 3 + 77};
+    for (int inversion = 0; inversion < 4; ++inversion) {
+        for (std::size_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); ++o) {
+            BitVector bv1, bv2;
+            fillPseudoRandom(bv1, bv1, 21, 1024 + 5, 30);
+            fillPseudoRandom(bv2, bv2, 22, 1024 * 2 + 50, 30);
+            if (inversion & 1) {
+                bv1.invert();
+            }
+            if (inversion & 2) {
+                bv2.invert();
+            }
+            BitVector expected(bv1);
+            for (std::size_t i = 0; i < 1024 * 6; ++i) {
+                if (bv2.get(i)) {
+                    expected.set(i + offsets[o], true);
+                }
+            }
+            bv1.append(bv2, offsets[o]);
+            REQUIRE(bv1.count(1024 * 6 + offsets[o]) == expected.count(1024 * 6 + offsets[o])); // Count matches.
+            REQUIRE(bv1.slice(0, 1024 * 6 + offsets[o]) == expected.slice(0, 1024 * 6 + offsets[o])); // Matches merging bit by bit.
+        }
+    }
+
+    // Block aligned appends share the data:
+    {
+        typedef bitlib2::BitVector<bitlib2::BitBlock<1024, CountingAllocatorSelector> > CountingBitVector;
+        CountingBitVector bv3, bv4;
+        fillPseudoRandom(bv3, bv3, 23, 1024 * 2, 40);
+        fillPseudoRandom(bv4, bv4, 24, 1024 * 4, 40);
+        const std::size_t allocationCount = testAllocationCount;
+        bv3.append(bv4, 1024 * 2);
+        const std::size_t appendAllocationCount = testAllocationCount - allocationCount;
+        REQUIRE(appendAllocationCount <= 3 + 4); // Only containers and reference counters are allocated.
+        REQUIRE(bv3.count() == bv3.count(1024 * 2) + bv4.count());
+    }
+
+    // Only the blocks the other bitvector lands on are touched:
+    {
+        typedef bitlib2::BitBlock<1024> BitBlock;
+        typedef bitlib2::BitVector<BitBlock, bitlib2::SparseBlockDirectory<BitBlock> > SparseBitVector;
+        const std::size_t far = (std::size_t)1 << 40;
+        SparseBitVector bv5, bv6;
+        bv5.set(3, true).set(far + 2000, true);
+        bv6.set(10, true).set(1020, true).set(far, true);
+        bv5.append(bv6, far + 100);
+        REQUIRE(bv5.count() == 5);
+        REQUIRE(bv5.getNext(4) == far + 110);
+        REQUIRE(bv5.getNext(far + 111) == far + 1120);
+        REQUIRE(bv5.getNext(far + 1121) == far + 2000);
+        REQUIRE(bv5.last() == far * 2 + 100);
+
+        bv6.append(bv6, 5);
+        REQUIRE(bv6.count() == 6); // Appending to itself.
+        REQUIRE(bv6.get(1025) == true);
+        REQUIRE(bv6.get(far + 5) == true);
+    }
+}
+
+
+TEST_CASE("bitvector/full_blocks", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1024> > BitVector;
+    typedef BitVector::IndexType IndexType;
+
+    // Blocks: 0 random, 1 full, 2 empty, 3 full, 4 random, 5 full (b1 only).
+    for (int inversion = 0; inversion < 4; ++inversion) {
+        BitVector b1, b2, r1, r2;
+        fillPseudoRandom(b1, r1, 25, 1024, 50);
+        fillPseudoRandom(b2, r2, 26, 1024, 50);
+        b1.setRange(1024, 1024 * 2, true).setRange(1024 * 3, 1024 * 4, true).setRange(1024 * 5, 1024 * 6, true);
+        b2.setRange(1024, 1024 * 2, true).setRange(1024 * 4 + 5, 1024 * 4 + 300, true);
+        b2.setRange(1024 * 2, 1024 * 3, true).setRange(1024 * 2, 1024 * 3, false); // Empty data block.
+        b1.setRange(1024 * 4, 1024 * 4 + 1, true);
+        for (std::size_t i = 1024; i < 1024 * 6; ++i) {
+            r1.set(i, b1.get(i));
+            r2.set(i, b2.get(i));
+        }
+        if (inversion & 1) {
+            b1.invert();
+            r1.invert();
+        }
+        if (inversion & 2) {
+            b2.invert();
+            r2.invert();
+        }
+
+        REQUIRE(b1.andCount(b2) == r1.andCount(r2)); // Non-materializing counts with full blocks.
+        REQUIRE(b1.orCount(b2) == r1.orCount(r2));
+        REQUIRE(b1.xorCount(b2) == r1.xorCount(r2));
+        REQUIRE(b1.andNotCount(b2) == r1.andNotCount(r2));
+        REQUIRE(b2.andNotCount(b1) == r2.andNotCount(r1));
+
+        BitVector bt, rt;
+        bt = b1; bt.bitAnd(b2);
+        rt = r1; rt.bitAnd(r2);
+        REQUIRE(bt == rt); // Bitwise and with full blocks.
+        REQUIRE(bt.count(1024 * 8) == rt.count(1024 * 8));
+        bt = b2; bt.bitAnd(b1);
+        REQUIRE(bt == rt);
+        bt = b1; bt.bitAndInv(b2);
+        rt = r1; rt.bitAndInv(r2);
+        REQUIRE(bt == rt); // Bitwise and inverse with full blocks.
+        bt = b2; bt.bitAndInv(b1);
+        rt = r2; rt.bitAndInv(r1);
+        REQUIRE(bt == rt);
+        bt = b1; bt.bitOr(b2);
+        rt = r1; rt.bitOr(r2);
+        REQUIRE(bt == rt); // Bitwise or with full blocks.
+        REQUIRE(bt.count(1024 * 8) == rt.count(1024 * 8));
+        bt = b1; bt.bitOrInv(b2);
+        rt = r1; rt.bitOrInv(r2);
+        REQUIRE(bt == rt); // Bitwise or inverse with full blocks.
+        bt = b1; bt.bitXor(b2);
+        rt = r1; rt.bitXor(r2);
+        REQUIRE(bt == rt); // Bitwise xor with full blocks.
+        REQUIRE(bt.count(1024 * 8) == rt.count(1024 * 8));
+        const IndexType count = b1.bitXorCount(b2);
+        REQUIRE(count == r1.bitXorCount(r2)); // Fused count with full blocks.
+        REQUIRE(b1 == r1);
+    }
+
+    // Operations on full blocks do not allocate:
+    {
+        typedef bitlib2::BitVector<bitlib2::BitBlock<1024, CountingAllocatorSelector> > CountingBitVector;
+        CountingBitVector bv1, bv2, bv3;
+        bv1.setRange(0, 1024 * 4, true);
+        fillPseudoRandom(bv2, bv2, 27, 1024 * 4, 50);
+        bv3.set(1024 * 5, true);
+        const std::size_t allocationCount = testAllocationCount;
+        bv1.bitAnd(bv2);
+        bv1.bitOr(bv3);
+        bv1.setRange(0, 1024 * 4, true);
+        bv1.bitOr(bv2);
+        bv2.bitAndInv(bv3);
+        REQUIRE(bv1.count() == 1024 * 4 + 1);
+        REQUIRE(bv1.getNext(0, false) == 1024 * 4);
+        const std::size_t opAllocationCount = testAllocationCount - allocationCount;
+        REQUIRE(opAllocationCount <= 4 + 2); // Only reference counters and containers are allocated.
+    }
+}
+
+
+template <typename BitVector>
+static void fillBlockDensities(BitVector& bv, std::vector<bool>& bits, unsigned int seed, const int* densities, std::size_t blockCount) {
+    for (std::size_t i = 0; i < blockCount * 1024; ++i) {
+        seed = seed * 1103515245 + 12345;
+        const bool value = densities[i / 1024] == 100 || (int)((seed >> 16) % 1000) < densities[i / 1024];
+        if (value && densities[i / 1024] != 100) {
+            bv.set(i, true);
+        }
+        bits[i] = value;
+    }
+    for (std::size_t blockIndex = 0; blockIndex < blockCount; ++blockIndex) {
+        if (densities[blockIndex] == 100) {
+            bv.setRange(blockIndex * 1024, blockIndex * 1024 + 1024, true);
+        }
+    }
+}
+
+
+template <typename BitVector>
+static bool equalsBits(const BitVector& bv, const std::vector<bool>& bits) {
+    for (std::size_t i = 0; i < bits.size(); ++i) {
+        if (bv.get(i) != bits[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+template <typename BitVector>
+static void checkOpsAgainstBits(const BitVector& b1, const std::vector<bool>& r1, const BitVector& b2, const std::vector<bool>& r2, bool checkDerived) {
+    typedef typename BitVector::IndexType IndexType;
+    const std::size_t length = r1.size();
+    std::vector<bool> rAnd(length), rAndInv(length), rInvAnd(length), rOr(length), rXor(length);
+    IndexType countAnd = 0, countAndInv = 0, countOr = 0, countXor = 0, count1 = 0;
+    for (std::size_t i = 0; i < length; ++i) {
+        rAnd[i] = r1[i] && r2[i];
+        rAndInv[i] = r1[i] && !r2[i];
+        rInvAnd[i] = !r1[i] && r2[i];
+        rOr[i] = r1[i] || r2[i];
+        rXor[i] = r1[i] != r2[i];
+        countAnd += rAnd[i];
+        countAndInv += rAndInv[i];
+        countOr += rOr[i];
+        countXor += rXor[i];
+        count1 += r1[i];
+    }
+
+    BitVector bt;
+    bt = b1; bt.bitAnd(b2);
+    REQUIRE(equalsBits(bt, rAnd)); // Bitwise and with sparse containers.
+    bt = b1; bt.bitAndInv(b2);
+    REQUIRE(equalsBits(bt, rAndInv)); // Bitwise and inverse with sparse containers.
+    bt = b2; bt.bitAndInv(b1);
+    REQUIRE(equalsBits(bt, rInvAnd));
+    bt = b1; bt.bitOr(b2);
+    REQUIRE(equalsBits(bt, rOr)); // Bitwise or with sparse containers.
+    bt = b1; bt.bitXor(b2);
+    REQUIRE(equalsBits(bt, rXor)); // Bitwise xor with sparse containers.
+
+    if (checkDerived) {
+        REQUIRE(b1.count() == count1);
+        REQUIRE(b1.andCount(b2) == countAnd); // Non-materializing counts with sparse containers.
+        REQUIRE(b1.andNotCount(b2) == countAndInv);
+        REQUIRE(b1.orCount(b2) == countOr);
+        REQUIRE(b1.xorCount(b2) == countXor);
+        bt = b1;
+        REQUIRE(bt.bitAndCount(b2) == countAnd); // Fused counts with sparse containers.
+        bt = b1;
+        REQUIRE(bt.bitOrCount(b2) == countOr);
+        bt = b1;
+        REQUIRE(bt.bitXorCount(b2) == countXor);
+        REQUIRE(equalsBits(bt, rXor));
+
+        std::vector<IndexType> indexes;
+        for (typename BitVector::const_iterator it = b1.begin(); it != b1.end(); ++it) {
+            indexes.push_back(*it);
+        }
+        REQUIRE(indexes.size() == count1); // Iteration over sparse containers.
+        IndexType next = b1.getNext(0);
+        for (std::size_t i = 0; i < indexes.size(); ++i) {
+            REQUIRE(b1.select(i) == indexes[i]);
+            REQUIRE(next == indexes[i]);
+            next = b1.getNext(next + 1);
+        }
+        REQUIRE(b1.rank(indexes[100]) == 100);
+
+        bitlib2::BitVector<bitlib2::BitBlock<2048> > other;
+        for (std::size_t i = 0; i < indexes.size(); ++i) {
+            other.set(indexes[i], true);
+        }
+        REQUIRE(b1 == other); // Equality with another block type.
+        bt = b1;
+        bt.shiftLeft(100).shiftRight(100);
+        REQUIRE(bt == b1); // Shifts with sparse containers.
+    }
+}
+
+
+TEST_CASE("bitvector/array_container", "[bitvector]") {
+    typedef bitlib2::BitBlock<1024> BitBlock; // Position arrays of up to 64 'ON' bits.
+    typedef bitlib2::BitVector<BitBlock> BitVector;
+    typedef BitVector::IndexType IndexType;
+
+    // Switching between position array and bitmap:
+    {
+        BitBlock block;
+        block.set(700, true);
+        REQUIRE(block.isArray()); // Setting a bit of an empty block creates a position array.
+        for (IndexType i = 0; i < 64; ++i) {
+            block.set(i * 8, true);
+        }
+        REQUIRE(!block.isArray()); // Outgrowing the maximum size turns it into a bitmap.
+        REQUIRE(block.count() == 65);
+        for (IndexType i = 0; i < 33; ++i) {
+            block.set(i * 8, false);
+        }
+        REQUIRE(block.isArray()); // Clearing down to half the maximum size turns it back into a position array.
+        REQUIRE(block.count() == 32);
+        REQUIRE(block.count(300, 701) == 27);
+        REQUIRE(block.get(700) == true);
+        REQUIRE(block.get(264) == true);
+        REQUIRE(block.get(256) == false);
+        REQUIRE(block.getNext(257, true) == 264);
+        REQUIRE(block.getNext(264, false) == 265);
+        REQUIRE(block.getPrev(263, true) == 1024); // Bits below 264 are all off.
+        REQUIRE(block.getPrev(701, true) == 700);
+        REQUIRE(block.getPrev(700, false) == 699);
+        REQUIRE(block.select(0, 31, true) == 700);
+        REQUIRE(block.select(264, 1, false) == 266);
+        REQUIRE(block.getWord(4) == 0x0101010101010100ULL);
+        block.setRange(0, 512, false);
+        REQUIRE(block.count() == 1); // Clearing a range removes the positions.
+        block.set(700, false);
+        REQUIRE(!block.hasData()); // Clearing the last bit releases the array.
+    }
+
+    // Setting many bits of position arrays and run containers:
+    {
+        static const IndexType indexes[] = {1300, 1010, 1500, 1010, 1200, 1999}; // Unsorted, with a duplicate.
+        BitBlock block;
+        block.setMany(indexes, indexes + 6, 1000, true);
+        REQUIRE(block.isArray()); // Merged into the (empty) position array.
+        REQUIRE(block.count() == 5);
+        REQUIRE(block.getNext(0, true) == 10);
+        REQUIRE(block.getNext(11, true) == 200);
+        block.setMany(indexes + 1, indexes + 3, 1000, false);
+        REQUIRE(block.isArray());
+        REQUIRE(block.count() == 3);
+        REQUIRE(block.get(10) == false);
+        REQUIRE(block.get(300) == true);
+
+        BitBlock runs;
+        runs.setRange(100, 900, true);
+        runs.setMany(indexes, indexes + 6, 1000, false);
+        REQUIRE(runs.isRuns()); // Cuts the runs.
+        REQUIRE(runs.count() == 797);
+        REQUIRE(runs.get(300) == false);
+        REQUIRE(runs.get(301) == true);
+
+        std::vector<IndexType> many;
+        for (IndexType i = 0; i < 100; ++i) {
+            many.push_back(i * 10);
+        }
+        block.setMany(&many[0], &many[0] + many.size(), 0, true);
+        REQUIRE(!block.isArray()); // More indexes than fit the array go through a bitmap.
+        REQUIRE(block.count() == 101);
+    }
+
+    // Operations between position arrays, bitmaps, full and empty blocks:
+    static const int densities1[] = {1, 50, 0, 400, 2, 100, 60, 5};
+    static const int densities2[] = {3, 0, 100, 2, 500, 55, 1, 60};
+    const std::size_t length = 1024 * 8 + 100;
+    for (int inversion = 0; inversion < 4; ++inversion) {
+        BitVector b1, b2;
+        std::vector<bool> r1(length), r2(length);
+        fillBlockDensities(b1, r1, 31, densities1, 8);
+        fillBlockDensities(b2, r2, 32, densities2, 8);
+        if (inversion & 1) {
+            b1.invert();
+            r1.flip();
+        }
+        if (inversion & 2) {
+            b2.invert();
+            r2.flip();
+        }
+        REQUIRE(equalsBits(b1, r1));
+        REQUIRE(equalsBits(b2, r2));
+
+        checkOpsAgainstBits(b1, r1, b2, r2, inversion == 0);
+    }
+}
+
+
+static bool failAllocations = false;
+
+
+template <typename T>
+struct FailingAllocator : public std::allocator<T> {
+    template <typename U> struct rebind {
+        typedef FailingAllocator<U> other;
+    };
+
+    FailingAllocator() {}
+    template <typename U> FailingAllocator(const FailingAllocator<U>&) {}
+
+    T* allocate(std::size_t n, const void* = 0) {
+        return failAllocations ? NULL : std::allocator<T>::allocate(n);
+    }
+};
+
+
+struct FailingAllocatorSelector
+{
+    template <typename _BitBlock> struct BitBlockContainerAllocator {
+        typedef std::allocator<_BitBlock> type;
+    };
+    template <typename _Block> struct BitBlockDataAllocator {
+        typedef FailingAllocator<_Block> type;
+    };
+    template <typename _RefCounter> struct RefCounterAllocator {
+        typedef std::allocator<_RefCounter> type;
+    };
+};
+
+
+TEST_CASE("bitvector/array_allocation", "[bitvector]") {
+    typedef bitlib2::BitBlock<1024, FailingAllocatorSelector> BitBlock;
+    const std::size_t blockSize = sizeof(BitBlock);
+    REQUIRE(blockSize <= 4 * sizeof(void*)); // The array adds a single pointer to a block.
+
+    BitBlock block;
+    block.set(3, true);
+    block.set(7, true);
+    const BitBlock copy(block);
+    failAllocations = true;
+    REQUIRE_THROWS_AS(block.set(9, true), const std::bad_alloc&); // Copying shared positions fails.
+    failAllocations = false;
+    REQUIRE(block.count() == 2); // The block is unchanged.
+    REQUIRE(block.get(7) == true);
+    REQUIRE(block.get(9) == false);
+    block.set(9, true);
+    REQUIRE(block.count() == 3);
+    REQUIRE(copy.count() == 2);
+}
+
+
+TEST_CASE("bitvector/run_container", "[bitvector]") {
+    typedef bitlib2::BitBlock<1024> BitBlock; // Run containers of up to 32 runs.
+    typedef bitlib2::BitVector<BitBlock> BitVector;
+    typedef BitVector::IndexType IndexType;
+
+    // Building and querying a run container:
+    {
+        BitBlock block;
+        block.setRange(100, 300, true);
+        REQUIRE(block.isRuns()); // Setting a range of an empty block creates a run container.
+        REQUIRE(block.count() == 200);
+        block.setRange(500, 600, true);
+        block.set(300, true); // Extends the first run.
+        block.set(150, false); // Splits the first run.
+        REQUIRE(block.isRuns());
+        REQUIRE(block.count() == 300);
+        REQUIRE(block.count(140, 510) == 170);
+        REQUIRE(block.get(150) == false);
+        REQUIRE(block.get(151) == true);
+        REQUIRE(block.get(300) == true);
+        REQUIRE(block.get(301) == false);
+        REQUIRE(block.getNext(150, true) == 151);
+        REQUIRE(block.getNext(151, false) == 301);
+        REQUIRE(block.getPrev(499, true) == 300);
+        REQUIRE(block.getPrev(120, false) == 99);
+        REQUIRE(block.select(0, 50, true) == 151);
+        REQUIRE(block.select(0, 100, false) == 150);
+        REQUIRE(block.getWord(1) == (~0ULL << 36));
+        block.setRange(0, 1024, false);
+        REQUIRE(!block.hasData()); // Clearing all runs releases the container.
+    }
+
+    // Bitmap results with few runs are stored as runs on request:
+    {
+        BitBlock b1, b2;
+        for (IndexType i = 0; i < 1024; ++i) {
+            b1.set(i, i % 2 == 0 || (i >= 200 && i < 600));
+            b2.set(i, i % 2 == 1 || (i >= 200 && i < 600));
+        }
+        REQUIRE(!b1.isRuns());
+        REQUIRE(!b2.isRuns()); // Too many runs, kept as bitmaps.
+        b1.apply<bitlib2::operation::AND, false>(b2);
+        REQUIRE(!b1.isRuns()); // Dense results are not checked for runs.
+        REQUIRE(b1.count() == 400);
+        b1.optimize();
+        REQUIRE(b1.isRuns()); // A single run remains.
+        REQUIRE(b1.count() == 400);
+        REQUIRE(b1.getNext(0, true) == 200);
+        REQUIRE(b1.getNext(200, false) == 600);
+    }
+
+    // Operations between run containers, position arrays, bitmaps, full and empty blocks:
+    const std::size_t length = 1024 * 8 + 100;
+    for (int inversion = 0; inversion < 4; ++inversion) {
+        BitVector b1, b2;
+        std::vector<bool> r1(length), r2(length);
+        static const int densities[] = {0, 0, 0, 0, 0, 30, 0, 0};
+        fillBlockDensities(b2, r2, 42, densities, 8);
+        unsigned int seed = 41;
+        for (int i = 0; i < 60; ++i) {
+            seed = seed * 1103515245 + 12345;
+            const IndexType begin = (seed >> 8) % (1024 * 8);
+            seed = seed * 1103515245 + 12345;
+            const IndexType end = begin + (seed >> 8) % (i < 40 ? 64 : 700);
+            BitVector& bv = i % 2 == 0 ? b1 : b2;
+            std::vector<bool>& bits = i % 2 == 0 ? r1 : r2;
+            bv.setRange(begin, end, true);
+            for (IndexType j = begin; j < end; ++j) {
+                bits[j] = true;
+            }
+        }
+        if (inversion & 1) {
+            b1.invert();
+            r1.flip();
+        }
+        if (inversion & 2) {
+            b2.invert();
+            r2.flip();
+        }
+        REQUIRE(equalsBits(b1, r1));
+        REQUIRE(equalsBits(b2, r2));
+        checkOpsAgainstBits(b1, r1, b2, r2, inversion == 0);
+    }
+}
+
+
+template <typename BitBlock>
+static void checkEmptyBlockReclamation() {
+    typedef bitlib2::BitVector<BitBlock> BitVector;
+    const typename BitVector::IndexType INF = BitVector::INFINITE;
+    const std::size_t BlockSize = BitVector::BlockSize;
+
+    BitVector bv1, bv2;
+    fillPseudoRandom(bv1, bv2, 7, BlockSize * 8, 50);
+    bv2.set(3, !bv2.get(3));
+    const std::size_t liveCount = testAllocationCount - testDeallocationCount;
+    bv1.bitXor(bv2);
+    const std::size_t xorLiveCount = testAllocationCount - testDeallocationCount;
+    REQUIRE(bv1.count() == 1);
+    REQUIRE(bv1.getNext(0) == 3);
+    REQUIRE(xorLiveCount < liveCount - 7); // Emptied blocks are released.
+
+    const BitVector bv4(bv2);
+    bv2.bitAndInv(bv4);
+    REQUIRE(bv2.count() == 0);
+    REQUIRE(bv2.last() == INF);
+    REQUIRE(bv2 == BitVector()); // No trailing blocks are left.
+
+    BitVector bv3;
+    bv3.set(BlockSize * 5 + 1, true);
+    bv3.set(BlockSize * 5 + 2, true);
+    const std::size_t setLiveCount = testAllocationCount - testDeallocationCount;
+    bv3.set(BlockSize * 5 + 1, false);
+    bv3.set(BlockSize * 5 + 2, false);
+    const std::size_t clearLiveCount = testAllocationCount - testDeallocationCount;
+    REQUIRE(clearLiveCount < setLiveCount); // Clearing the last bits releases the block.
+    bv3.invert();
+    REQUIRE(bv3.get(BlockSize * 5 + 1) == true);
+    REQUIRE(bv3.count(BlockSize * 6) == BlockSize * 6);
+}
+
+
+TEST_CASE("bitvector/reclaim_empty_blocks", "[bitvector]") {
+    checkEmptyBlockReclamation<bitlib2::BitBlock<1024, CountingAllocatorSelector> >();
+    checkEmptyBlockReclamation<bitlib2::BitBlock<100000, CountingAllocatorSelector> >();
+}
+
+
+TEST_CASE("bitvector/compact", "[bitvector]") {
+    typedef bitlib2::BitVector<bitlib2::BitBlock<1024, CountingAllocatorSelector> > BitVector;
+
+    std::vector<BitVector> vectors(6), expected(6);
+    for (std::size_t i = 0; i < vectors.size(); ++i) {
+        fillPseudoRandom(vectors[i], expected[i], 9, 1024 * 4, 40); // Equal bitmaps.
+        vectors[i].setRange(1024 * 4 + 10, 1024 * 4 + 500, true); // Equal runs.
+        expected[i].setRange(1024 * 4 + 10, 1024 * 4 + 500, true);
+        vectors[i].set(1024 * 5 + 7, true); // Equal position arrays.
+        expected[i].set(1024 * 5 + 7, true);
+        vectors[i].set(1024 * 6 + i, true); // Different position arrays.
+        expected[i].set(1024 * 6 + i, true);
+        vectors[i].set(i, !vectors[i].get(i)); // A different bitmap.
+        expected[i].set(i, !expected[i].get(i));
+    }
+    vectors[3].setRange(1024 * 7, 1024 * 8, true); // Full blocks are shared already.
+
+    const std::size_t liveCount = testAllocationCount - testDeallocationCount;
+    REQUIRE(BitVector::compact(vectors.begin(), vectors.end()) == 5 * (3 + 1 + 1)); // Three bitmaps, runs and a position array per copy.
+    const std::size_t compactLiveCount = testAllocationCount - testDeallocationCount;
+    REQUIRE(compactLiveCount < liveCount - 20); // The duplicates are released.
+    REQUIRE(BitVector::compact(vectors.begin(), vectors.end()) == 0); // Nothing left to share.
+    REQUIRE(vectors[3].compact() == 0);
+
+    for (std::size_t i = 0; i < vectors.size(); ++i) {
+        if (i != 3) {
+            REQUIRE(vectors[i] == expected[i]); // The content does not change.
+        }
+    }
+    vectors[0].set(1024 + 5, !vectors[0].get(1024 + 5));
+    vectors[1].set(1024 * 4 + 100, false);
+    REQUIRE(vectors[0] != expected[0]); // Writes copy the shared data.
+    REQUIRE(vectors[1] != expected[1]);
+    REQUIRE(vectors[2] == expected[2]);
+    REQUIRE(vectors[4] == expected[4]);
+
+    BitVector single;
+    single.set(3, true).set(1024 + 3, true).set(1024 * 2 + 3, true);
+    single.setRange(1024 * 3, 1024 * 4, true);
+    single.setRange(1024 * 4, 1024 * 5, true);
+    REQUIRE(single.compact() == 2); // Equal blocks of a single bitvector are shared as well.
+    REQUIRE(single.count() == 3 + 2 * 1024);
+
+    std::vector<BitVector> containers(2);
+    for (std::size_t i = 0; i < 70; ++i) {
+        containers[1].set(i * 7, true);
+    }
+    for (std::size_t i = 0; i < 40; ++i) {
+        containers[0].set(i * 7, true); // Position array.
+    }
+    for (std::size_t i = 40; i < 70; ++i) {
+        containers[1].set(i * 7, false); // Bitmap with the same bits.
+    }
+    bitlib2::BitBlock<1024> arrayBlock, bitmapBlock;
+    for (std::size_t i = 0; i < 70; ++i) {
+        bitmapBlock.set(i * 7, true);
+    }
+    for (std::size_t i = 0; i < 40; ++i) {
+        arrayBlock.set(i * 7, true);
+    }
+    for (std::size_t i = 40; i < 70; ++i) {
+        bitmapBlock.set(i * 7, false);
+    }
+    REQUIRE(arrayBlock.isArray());
+    REQUIRE(!bitmapBlock.isArray());
+    REQUIRE(arrayBlock.hash() == bitmapBlock.hash()); // The hash does not depend on the container.
+    bitlib2::BitBlock<1024> runBlock, runBitmapBlock;
+    runBlock.setRange(100, 300, true);
+    runBlock.setRange(900, 1000, true);
+    for (std::size_t i = 100; i < 1000; ++i) {
+        runBitmapBlock.set(i, i < 300 || i >= 900);
+    }
+    REQUIRE(runBlock.isRuns());
+    REQUIRE(!runBitmapBlock.isRuns());
+    REQUIRE(runBlock.hash() == runBitmapBlock.hash());
+    REQUIRE(BitVector::compact(containers.begin(), containers.end()) == 1); // Shared across containers.
+    REQUIRE(containers[0] == containers[1]);
+}
+
+
+TEST_CASE("bitvector/sparse_directory", "[bitvector]") {
+    typedef bitlib2::BitBlock<1024> BitBlock;
+    typedef bitlib2::BitVector<BitBlock, bitlib2::SparseBlockDirectory<BitBlock> > SparseBitVector;
+    typedef SparseBitVector::IndexType IndexType;
+    const IndexType INF = SparseBitVector::INFINITE;
+    const IndexType far = (IndexType)1 << 50;
+
+    // Bits far apart only store their blocks:
+    {
+        SparseBitVector bv;
+        bv.set(5, true).set(far, true).set(far + 3000, true).set(far * 2, true);
+        REQUIRE(bv.count() == 4);
+        REQUIRE(bv.get(far) == true);
+        REQUIRE(bv.get(far + 1) == false);
+        REQUIRE(bv.get(far * 3) == false);
+        REQUIRE(bv.getNext(6) == far); // Skips the blocks which are not stored.
+        REQUIRE(bv.getNext(far + 1) == far + 3000);
+        REQUIRE(bv.getNext(far * 2 + 1) == INF);
+        REQUIRE(bv.getNext(far, false) == far + 1);
+        REQUIRE(bv.getPrev(far - 1) == 5);
+        REQUIRE(bv.getPrev(far * 2 - 1) == far + 3000);
+        REQUIRE(bv.getPrev(far + 3000, false) == far + 2999);
+        REQUIRE(bv.last() == far * 2);
+        REQUIRE(bv.count(far - 10, far + 10) == 1);
+        REQUIRE(bv.count(far + 1) == 2);
+        REQUIRE(bv.rank(far * 2) == 3);
+        REQUIRE(bv.rank(far * 3) == 4);
+        REQUIRE(bv.select(2) == far + 3000);
+        REQUIRE(bv.select(4) == INF);
+        SparseBitVector inverse(bv);
+        inverse.invert();
+        REQUIRE(inverse.select(far) == far + 2); // 'ON' bits in the gaps between stored blocks.
+        REQUIRE(inverse.select(5) == 6);
+
+        std::vector<IndexType> indexes;
+        for (SparseBitVector::const_iterator it = bv.begin(); it != bv.end(); ++it) {
+            indexes.push_back(*it);
+        }
+        REQUIRE(indexes.size() == 4);
+        REQUIRE(indexes[2] == far + 3000);
+
+        const SparseBitVector slice = bv.slice(far - 100, far + 5000);
+        REQUIRE(slice.count() == 2);
+        REQUIRE(slice.get(100) == true);
+        REQUIRE(slice.get(3100) == true);
+
+        SparseBitVector shifted(bv);
+        shifted.shiftRight(far);
+        REQUIRE(shifted.count() == 3);
+        REQUIRE(shifted.getNext(0) == 0);
+        shifted.shiftLeft(far + 7);
+        REQUIRE(shifted.getNext(0) == far + 7);
+        REQUIRE(shifted.last() == far * 2 + 7);
+
+        bv.set(far + 3000, false).set(far * 2, false);
+        REQUIRE(bv.last() == far); // Cleared blocks are dropped.
+        bv.invert();
+        REQUIRE(bv.get(7) == true);
+        REQUIRE(bv.get(far * 3) == true);
+        REQUIRE(bv.getNext(0, false) == 5);
+        REQUIRE(bv.getNext(6, false) == far);
+        REQUIRE(bv.getNext(far) == far + 1);
+        REQUIRE(bv.getPrev(far * 2, false) == far);
+        REQUIRE(bv.count(far + 1) == far - 1);
+    }
+
+    // 'OFF' bits in the gaps before, between and after stored blocks:
+    {
+        SparseBitVector bv;
+        bv.set(2053, true).set(far + 10, true);
+        bv.invert();
+        REQUIRE(bv.select(0) == 0); // Before the first stored block.
+        REQUIRE(bv.select(2052) == 2052);
+        REQUIRE(bv.select(2053) == 2054);
+        REQUIRE(bv.select(far - 5) == far - 4); // Between the stored blocks.
+        REQUIRE(bv.select(far + 9) == far + 11);
+        REQUIRE(bv.select(far + 10) == far + 12); // After the last stored block.
+        REQUIRE(bv.rank(2054) == 2053);
+        REQUIRE(bv.rank(far + 12) == far + 10);
+    }
+
+    // Cleared blocks are released where they are, not by rescanning the directory:
+    {
+        typedef bitlib2::SparseBlockDirectory<BitBlock> Directory;
+        const Directory::size_type NO_BLOCK = Directory::NO_BLOCK;
+        Directory blocks;
+        blocks.resize(10);
+        blocks[2].set(0, true);
+        blocks[5].set(0, true);
+        blocks[8].set(0, true);
+        blocks[2].set(0, false);
+        blocks[8].set(0, false);
+        blocks.trim();
+        REQUIRE(blocks.size() == 6); // Only the trailing blocks without data are dropped.
+        REQUIRE(blocks.nextPresent(0) == 2);
+        blocks.release(0, 3);
+        REQUIRE(blocks.size() == 6);
+        REQUIRE(blocks.nextPresent(0) == 5);
+        blocks[5].set(0, false);
+        blocks.release(5, 6);
+        REQUIRE(blocks.size() == 0);
+        REQUIRE(blocks.nextPresent(0) == NO_BLOCK);
+
+        SparseBitVector bv;
+        const IndexType count = 50000;
+        for (IndexType i = 0; i < count; ++i) {
+            bv.set(i * 4096, true); // Ordered inserts, one block each.
+        }
+        bv.set(0, false).set(2 * 4096, false);
+        for (IndexType i = count; i > count / 2; --i) {
+            bv.set((i - 1) * 4096, false); // Drops the last block each time.
+        }
+        REQUIRE(bv.count() == count / 2 - 2);
+        const IndexType lastIndex = (count / 2 - 1) * 4096;
+        REQUIRE(bv.last() == lastIndex);
+        REQUIRE(bv.getNext(0) == 4096);
+        REQUIRE(bv.getNext(4097) == 3 * 4096);
+    }
+
+    // Operations agree with the bit values and with the dense directory:
+    const std::size_t length = 1024 * 8 + 100;
+    for (int inversion = 0; inversion < 4; ++inversion) {
+        SparseBitVector b1, b2;
+        std::vector<bool> r1(length), r2(length);
+        static const int densities1[] = {0, 0, 30, 0, 100, 0, 2, 0};
+        static const int densities2[] = {0, 500, 0, 0, 30, 0, 0, 0};
+        fillBlockDensities(b1, r1, 43, densities1, 8);
+        fillBlockDensities(b2, r2, 44, densities2, 8);
+        b2.setRange(1024 * 6 + 10, 1024 * 7 + 20, true);
+        for (std::size_t i = 1024 * 6 + 10; i < 1024 * 7 + 20; ++i) {
+            r2[i] = true;
+        }
+        if (inversion & 1) {
+            b1.invert();
+            r1.flip();
+        }
+        if (inversion & 2) {
+            b2.invert();
+            r2.flip();
+        }
+        REQUIRE(equalsBits(b1, r1));
+        REQUIRE(equalsBits(b2, r2));
+        checkOpsAgainstBits(b1, r1, b2, r2, inversion == 0);
+
+        bitlib2::BitVector<BitBlock> d1, d2;
+        for (std::size_t i = 0; i < length; ++i) {
+            d1.set(i, (inversion & 1) ? !r1[i] : r1[i]);
+            d2.set(i, (inversion & 2) ? !r2[i] : r2[i]);
+        }
+        if (inversion & 1) {
+            d1.invert();
+        }
+        if (inversion & 2) {
+            d2.invert();
+        }
+        REQUIRE(b1 == d1); // Equality across directory types.
+        REQUIRE(d2 == b2);
+        d1.bitXor(d2);
+        SparseBitVector bt(b1);
+        bt.bitXor(b2);
+        REQUIRE(bt == d1);
+        REQUIRE(b1.xorCount(b2) == d1.count());
+    }
+}
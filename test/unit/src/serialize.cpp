@@ -57,3 +57,100 @@ TEST_CASE("serialize/streamserializer", "[serialize]") {
 
 }
 
+
+
+TEST_CASE("serialize/streamserializer_runs", "[serialize]") {
+    std::string serializedData;
+    bitlib2::BitVector<bitlib2::BitBlock<1024> > bv1;
+
+    {
+        std::ostringstream oss;
+        bitlib2::serialize::StreamSerializer serializer(oss);
+
+        bv1.setRange(100, 300, true);
+        bv1.setRange(500, 900, true);
+        bv1.setRange(1500, 1501, true);
+        bv1.setRange(2040, 2050, true);
+        bv1.serialize(serializer);
+        REQUIRE(serializer.failed() == false);
+        serializedData = oss.str();
+        REQUIRE(serializedData.length() < 128); // Runs are written as index pairs.
+    }
+
+    {
+        std::istringstream iss(serializedData);
+        bitlib2::serialize::StreamDeserializer deserializer(iss);
+        bitlib2::BitVector<bitlib2::BitBlock<1024> > bv2;
+
+        bv2.deserialize(deserializer);
+        REQUIRE(deserializer.failed() == false);
+        REQUIRE(bv1 == bv2); // Runs are read back directly.
+        REQUIRE(bv2.count() == 200 + 400 + 1 + 10);
+    }
+
+    {
+        std::istringstream iss(serializedData);
+        bitlib2::serialize::StreamDeserializer deserializer(iss);
+        bitlib2::BitVector<bitlib2::BitBlock<256> > bv2;
+
+        bv2.deserialize(deserializer);
+        REQUIRE(deserializer.failed() == false);
+        REQUIRE(bv2.get(99) == false); // Runs are expanded for other block sizes.
+        REQUIRE(bv2.get(100) == true);
+        REQUIRE(bv2.get(899) == true);
+        REQUIRE(bv2.get(900) == false);
+        REQUIRE(bv2.get(2049) == true);
+        REQUIRE(bv2.count() == 200 + 400 + 1 + 10);
+    }
+}
+
+
+TEST_CASE("serialize/streamserializer_sparse", "[serialize]") {
+    typedef bitlib2::BitBlock<1024> BitBlock;
+    typedef bitlib2::BitVector<BitBlock, bitlib2::SparseBlockDirectory<BitBlock> > SparseBitVector;
+    const SparseBitVector::IndexType far = (SparseBitVector::IndexType)1 << 40;
+    std::string serializedData;
+    SparseBitVector bv1;
+
+    {
+        std::ostringstream oss;
+        bitlib2::serialize::StreamSerializer serializer(oss);
+
+        bv1.set(3, true).set(far, true).set(far * 2 + 5, true);
+        bv1.serialize(serializer);
+        REQUIRE(serializer.failed() == false);
+        serializedData = oss.str();
+        REQUIRE(serializedData.length() < 1024); // Gaps are written as empty segments.
+    }
+
+    {
+        std::istringstream iss(serializedData);
+        bitlib2::serialize::StreamDeserializer deserializer(iss);
+        SparseBitVector bv2;
+        bv2.set(far + 1, true); // Bits in the gaps are cleared.
+
+        bv2.deserialize(deserializer);
+        REQUIRE(deserializer.failed() == false);
+        REQUIRE(bv1 == bv2); // Gaps are skipped without reading every block.
+        REQUIRE(bv2.count() == 3);
+        REQUIRE(bv2.last() == far * 2 + 5);
+    }
+
+    {
+        std::ostringstream oss;
+        bitlib2::serialize::StreamSerializer serializer(oss);
+        bitlib2::BitVector<BitBlock> bv3;
+        bv3.set(5, true).set(1024 * 1000 + 7, true);
+        bv3.serialize(serializer);
+
+        std::istringstream iss(oss.str());
+        bitlib2::serialize::StreamDeserializer deserializer(iss);
+        bitlib2::BitVector<BitBlock> bv4;
+        bv4.setRange(0, 1024 * 2000, true);
+
+        bv4.deserialize(deserializer);
+        REQUIRE(deserializer.failed() == false);
+        REQUIRE(bv3 == bv4); // Dense bitvectors skip empty blocks as well.
+        REQUIRE(bv4.count() == 2);
+    }
+}
@@ -27,3 +27,119 @@ TEST_CASE("util/countBits", "[util]") {
     REQUIRE(bitlib2::util::countBits(data, 24) == 5);
 }
 
+
+
+TEST_CASE("util/countBitsInBytes", "[util]") {
+    bitlib2::byte data[1031];
+    unsigned int seed = 12345;
+    for (std::size_t i = 0; i < sizeof(data); ++i) {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (seed >> 16) & 0xFF;
+    }
+
+    const std::size_t lengths[] = {0, 1, 7, 8, 31, 32, 33, 64, 511, 512, 513, 1024, 1031};
+    for (std::size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); ++l) {
+        const std::size_t expected = bitlib2::util::countBitsInBytesLUT(data, lengths[l]);
+        REQUIRE(bitlib2::util::countBitsInBytes(data, lengths[l]) == expected); // Dispatched kernel matches the lookup table.
+        REQUIRE(bitlib2::util::countBitsInBytesWord(data, lengths[l]) == expected); // Word kernel matches the lookup table.
+#ifdef BITLIB2_X86_DISPATCH
+        const bitlib2::util::CpuFeatures& cpu = bitlib2::util::CpuFeatures::get();
+        if (cpu.popcnt) {
+            REQUIRE(bitlib2::util::countBitsInBytesPopcnt(data, lengths[l]) == expected); // POPCNT kernel matches the lookup table.
+        }
+        if (cpu.avx2 && cpu.popcnt) {
+            REQUIRE(bitlib2::util::countBitsInBytesAvx2(data, lengths[l]) == expected); // AVX2 kernel matches the lookup table.
+        }
+#ifdef BITLIB2_X86_AVX512_DISPATCH
+        if (cpu.avx512vpopcntdq && cpu.popcnt) {
+            REQUIRE(bitlib2::util::countBitsInBytesAvx512(data, lengths[l]) == expected); // AVX-512 kernel matches the lookup table.
+        }
+#endif
+#endif
+    }
+
+    std::memset(data, 0xFF, sizeof(data));
+    REQUIRE(bitlib2::util::countBitsInBytes(data, sizeof(data)) == sizeof(data) * 8); // All bits on.
+}
+
+
+TEST_CASE("util/getNextBitWithValue", "[util]") {
+    bitlib2::byte data[83] = {0};
+    const std::size_t onBits[] = {0, 3, 63, 64, 200, 457, 458, 511, 512, 600, 640, 657, 663};
+    for (std::size_t i = 0; i < sizeof(onBits) / sizeof(onBits[0]); ++i) {
+        data[onBits[i] / 8] |= (bitlib2::byte)1 << (onBits[i] % 8);
+    }
+
+    for (int value = 0; value < 2; ++value) {
+        for (std::size_t byteCount = 1; byteCount <= sizeof(data); byteCount += 13) {
+            for (std::size_t start = 0; start < byteCount * 8; ++start) {
+                std::size_t expected = (std::size_t)-1;
+                for (std::size_t i = start; i < byteCount * 8; ++i) {
+                    if (((data[i / 8] >> (i % 8)) & 1) == value) {
+                        expected = i;
+                        break;
+                    }
+                }
+                REQUIRE(bitlib2::util::getNextBitWithValue(data, byteCount, start, value) == expected); // Matches a bit by bit scan.
+            }
+        }
+    }
+}
+
+
+TEST_CASE("util/getPrevBitWithValue", "[util]") {
+    bitlib2::byte data[83] = {0};
+    const std::size_t onBits[] = {0, 3, 63, 64, 200, 457, 458, 511, 512, 600, 640, 657, 663};
+    for (std::size_t i = 0; i < sizeof(onBits) / sizeof(onBits[0]); ++i) {
+        data[onBits[i] / 8] |= (bitlib2::byte)1 << (onBits[i] % 8);
+    }
+
+    for (int value = 0; value < 2; ++value) {
+        for (std::size_t byteCount = 1; byteCount <= sizeof(data); byteCount += 13) {
+            for (std::size_t start = 0; start < byteCount * 8; ++start) {
+                std::size_t expected = (std::size_t)-1;
+                for (std::size_t i = start + 1; i-- > 0; ) {
+                    if (((data[i / 8] >> (i % 8)) & 1) == value) {
+                        expected = i;
+                        break;
+                    }
+                }
+                REQUIRE(bitlib2::util::getPrevBitWithValue(data, byteCount, start, value) == expected); // Matches a bit by bit scan.
+            }
+        }
+    }
+}
+
+
+TEST_CASE("util/selectBitWithValue", "[util]") {
+    bitlib2::byte data[83] = {0};
+    const std::size_t onBits[] = {0, 3, 63, 64, 200, 457, 458, 511, 512, 600, 640, 657, 663};
+    for (std::size_t i = 0; i < sizeof(onBits) / sizeof(onBits[0]); ++i) {
+        data[onBits[i] / 8] |= (bitlib2::byte)1 << (onBits[i] % 8);
+    }
+
+    for (int value = 0; value < 2; ++value) {
+        for (std::size_t byteCount = 1; byteCount <= sizeof(data); byteCount += 13) {
+            for (std::size_t start = 0; start < byteCount * 8; start += 7) {
+                for (std::size_t rank = 0; rank < 20; ++rank) {
+                    std::size_t expected = (std::size_t)-1;
+                    std::size_t seen = 0;
+                    for (std::size_t i = start; i < byteCount * 8; ++i) {
+                        if (((data[i / 8] >> (i % 8)) & 1) == value && seen++ == rank) {
+                            expected = i;
+                            break;
+                        }
+                    }
+                    REQUIRE(bitlib2::util::selectBitWithValue(data, byteCount, start, rank, value) == expected); // Matches a bit by bit scan.
+                }
+            }
+        }
+    }
+
+    const unsigned long long w = 0x8000F00000000301ULL;
+    const unsigned int expected[] = {0, 8, 9, 44, 45, 46, 47, 63};
+    for (unsigned int rank = 0; rank < 8; ++rank) {
+        REQUIRE(bitlib2::util::selectInWordPortable(w, rank) == expected[rank]); // Portable in-word select.
+        REQUIRE(bitlib2::util::selectInWord(w, rank) == expected[rank]); // Dispatched in-word select.
+    }
+}